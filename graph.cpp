@@ -1,40 +1,178 @@
 #include <iostream>
 #include <map>
 #include <vector>
+#include <iterator>
 #include <list>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <string>
+#include <iomanip>
+#include <condition_variable>
 #include <ctime>    // standard C library
 #include <cstdlib>  // standard C library
+#include <cmath>
+#include <climits>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 
 // forward class declarations
 class graphPoint;
+class NodeNumberSet;
 class Graph;
+class GraphBuilder;
+class GraphSnapshot;
+class SearchWorkspace;
+class ReachabilityIndex;
+class BreadthFirstWorkspace;
+class VersionedGraph;
+class GraphAnalytics;
+class ShardedGraph;
+
+
+// a node found by a range search, and the cost of getting to it
+struct settledNode
+{
+   unsigned int m_nodeNumber;
+   int m_pathCost;
+};
 
+// one of the routes found by ShortestPathAlgo::alternatives()
+struct alternativePath
+{
+   std::list<unsigned int> m_nodes;
+   int m_pathCost;
+};
 
 class ShortestPathAlgo
 {
+public:
+   // what a path costs: the sum of its edge weights, or just the number of edges in it
+   enum queryMode { WEIGHTED, HOP_COUNT };
+
 private:
    std::list<unsigned int> *pathList;
    int pathCost;  // the path cost, or (-1) if no path exists
+   SearchWorkspace *work;  // scratch space for searches on a GraphSnapshot
+   std::vector<settledNode> *withinList;  // the result of within()
+   queryMode mode;
+   BreadthFirstWorkspace *bfsWork;        // scratch space for HOP_COUNT searches
+   std::vector<SearchWorkspace> *pathsWork;           // scratch space for alternatives(), one per thread
+   std::vector<alternativePath> *alternativeList;     // the result of alternatives()
+   std::vector<int> *costTable;                       // the result of distances()
 
 public:
 
    ShortestPathAlgo();
    ~ShortestPathAlgo();
 
+   // WEIGHTED (the default) runs Dijkstra.  HOP_COUNT runs a parallel breadth first search, and path_size
+   // gives the number of edges in the path
+   void setMode(queryMode newMode);
+
    // returns a count of the nodes
    unsigned int verticies(Graph &G);
 
-   // returns the cost of the path (or -1 if no path exists)
+   // returns the cost of the path (or -1 if no path exists).  WEIGHTED searches the Graph itself, and skips the
+   // search when G's snapshot is up to date and says there's no route.  HOP_COUNT searches G's snapshot,
+   // which costs O(V+E) to build again first if G has changed since it was made
    int path_size( Graph &G, unsigned int originNode, unsigned int destNode );
 
-   // returns a std::list pointer with the path
+   // returns a std::list pointer with the path (costs as for path_size)
    std::list<unsigned int> *path( Graph &G, unsigned int originNode, unsigned int destNode);
 
+   // the same, but on a read-only snapshot of a graph.  Use one ShortestPathAlgo per thread.
+   int path_size( const GraphSnapshot &S, unsigned int originNode, unsigned int destNode );
+   std::list<unsigned int> *path( const GraphSnapshot &S, unsigned int originNode, unsigned int destNode);
+
+   // the same, across the shards of a ShardedGraph (always WEIGHTED)
+   int path_size( ShardedGraph &G, unsigned int originNode, unsigned int destNode );
+   std::list<unsigned int> *path( ShardedGraph &G, unsigned int originNode, unsigned int destNode);
+
+   // returns up to k loopless paths from originNode to destNode, cheapest first.  The first is the same as
+   // path() gives, and the rest are the next best alternatives (always WEIGHTED)
+   std::vector<alternativePath> *alternatives( Graph &G, unsigned int originNode, unsigned int destNode, unsigned int k);
+   std::vector<alternativePath> *alternatives( const GraphSnapshot &S, unsigned int originNode, unsigned int destNode, unsigned int k);
+
+   // returns the cost from every one of originNodes to every one of destNodes, row major (the cost from
+   // originNodes[i] to destNodes[j] is at i*destNodes.size() + j), with -1 where there's no path
+   std::vector<int> *distances( Graph &G, const std::vector<unsigned int> &originNodes, const std::vector<unsigned int> &destNodes);
+   std::vector<int> *distances( const GraphSnapshot &S, const std::vector<unsigned int> &originNodes, const std::vector<unsigned int> &destNodes);
+
+   // returns every node that can be reached from originNode for a cost of maxCost or less, cheapest first
+   std::vector<settledNode> *within( Graph &G, unsigned int originNode, int maxCost);
+   std::vector<settledNode> *within( const GraphSnapshot &S, unsigned int originNode, int maxCost);
+
    // this helps print the path list
    friend std::ostream &operator<< (std::ostream &cout, std::list<unsigned int> *path);
 
 
 };
+//-------------------------------------------------------------------------------------------------------
+//  A set of node numbers in one flat array (open addressing with linear probing), so each member costs
+//  4 bytes plus the empty slots, and adding, finding or removing one is O(1) however many there are.
+//  0xffffffff can't be a member, it marks the empty slots
+//-------------------------------------------------------------------------------------------------------
+//
+class NodeNumberSet
+{
+
+private:
+   static const unsigned int EMPTY = 0xffffffff;
+
+   std::vector<unsigned int> m_slots;   // a power of 2 of them (or none), at most 3/4 full
+   unsigned int m_size;                 // how many are in use
+
+   unsigned int homeSlot(unsigned int nodeNumber) const;
+   void rehash(unsigned int numSlots);
+
+public:
+   // visits the members in no particular order
+   class const_iterator
+   {
+   private:
+      const unsigned int *m_slot;
+      const unsigned int *m_end;
+
+   public:
+      typedef std::forward_iterator_tag iterator_category;
+      typedef unsigned int value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef const unsigned int *pointer;
+      typedef const unsigned int &reference;
+
+      const_iterator(const unsigned int *slot, const unsigned int *end) : m_slot(slot), m_end(end)
+      {
+         while((m_slot != m_end) && (*m_slot == EMPTY)) m_slot++;
+      }
+      unsigned int operator*() const { return *m_slot; }
+      const_iterator &operator++() { m_slot++; while((m_slot != m_end) && (*m_slot == EMPTY)) m_slot++; return *this; }
+      bool operator==(const const_iterator &other) const { return m_slot == other.m_slot; }
+      bool operator!=(const const_iterator &other) const { return m_slot != other.m_slot; }
+   };
+
+   NodeNumberSet();
+   unsigned int size() const;
+   bool empty() const;
+   bool contains(unsigned int nodeNumber) const;
+   void insert(unsigned int nodeNumber);
+   void erase(unsigned int nodeNumber);
+   void reserve(unsigned int numMembers);
+   void swap(NodeNumberSet &other);
+   const_iterator begin() const;
+   const_iterator end() const;
+};
+
 //-------------------------------------------------------------------------------------------------------
 //  A class defining an entire graph, which is comprised of graphPoints with edges to other graphPoints
 //-------------------------------------------------------------------------------------------------------
@@ -42,14 +180,28 @@ public:
 class Graph
 {
 
+   friend class GraphBuilder;
+   friend class GraphSnapshot;
+
 private:
    std::map< int, graphPoint* > graphNodes;// a map of all graphPoints (i.e. nodes, vertices) in the graph
    unsigned int m_totalNumVerticies;       // the total number of vertices (nodes) in this graph
    unsigned int m_totalNumEdges;           // the total number of edges in this graph
    int m_originNode;                       // the node number of the origin (-1 if not assigned)
+   GraphSnapshot *m_snapshot;              // a read-only copy of this graph, or NULL if it's out of date
+   SearchWorkspace *m_reachWork;           // scratch space for canReach()
+   std::map<unsigned int, NodeNumberSet> m_danglingInEdges;  // sources of edges to nodes that
+                                                            // don't exist (yet), by dest node
+
+   void invalidateSnapshot();              // call whenever the nodes or edges change
+   void adoptDanglingInEdges(graphPoint *node);
+
+   Graph(const Graph &);                   // not copyable, since a Graph owns its graphPoints and snapshot
+   Graph &operator=(const Graph &);        //   (declared but never defined)
 
 public:
    Graph();
+   ~Graph();
    void addNode(unsigned int nodeNumber);
    void removeNode(unsigned int nodeNumber);
    void setNodeValue(unsigned int nodeNumber, unsigned int cost);
@@ -67,6 +219,9 @@ public:
    bool isNodeVisited(unsigned int nodeNumber);
    void setNodeVisited(unsigned int nodeNumber);
    void doDijkstra( unsigned int originNode, unsigned int destNode, std::list<unsigned int> *pathResult, int &pathCost);
+   bool canReach(unsigned int originNode, unsigned int destNode);
+   const NodeNumberSet *getInEdges(unsigned int nodeNumber);  // the nodes with an edge to this one
+   const GraphSnapshot &getSnapshot();     // made when first needed after a change
    void printGraph();
 };
 
@@ -79,6 +234,8 @@ class graphPoint
 {
 
    friend class Graph;
+   friend class GraphBuilder;
+   friend class GraphSnapshot;
 
 private:
    unsigned int m_nodeNumber;                    // a unique identifier for this node
@@ -87,6 +244,7 @@ private:
    int    m_totalCost;                           // total path cost for this instance
    bool   m_visited;                             // has this instance been visited in the algorthim?
    unsigned int m_numEdges;                      // this number of edges for this instance
+   NodeNumberSet m_inEdges;                      // the nodes with an edge to this node
 
 public:
    graphPoint( unsigned int nodeNumber, int cost, bool visited);
@@ -96,6 +254,9 @@ public:
    int setEdgeValue(unsigned int sourceNodeNumber,unsigned int NodeNumber, unsigned int weight );
    int getEdgeValue(unsigned int sourceNodeNumber );
    int modifyEdge(unsigned int dest_node, unsigned int weight);
+   bool hasInEdge(unsigned int source_node);
+   void addInEdge(unsigned int source_node);
+   void removeInEdge(unsigned int source_node);
    int getPointCost ();
    void setPointCost (int cost);
    bool modifyPoint (int cost, bool visited);
@@ -105,374 +266,4867 @@ public:
 
 
 };
- 
-//*****************************************************************
-//**
-//** graphPoint methods
-//**
-//*****************************************************************
 
-
-graphPoint::graphPoint( unsigned int nodeNumber, int cost = (-1), bool visited = false )
+//-------------------------------------------------------------------------------------------------------
+//  A class for loading a whole graph at once.  Edges are collected in a flat buffer, radix sorted by
+//  (source, dest) and emitted into a Graph in one pass, instead of one set of map lookups per addEdge().
+//  When only a read-only graph is needed, buildSnapshot() skips the Graph (and its map per node) altogether
+//  and lays the sorted edges straight into a GraphSnapshot's arrays
+//-------------------------------------------------------------------------------------------------------
+//
+class GraphBuilder
 {
-   m_totalCost = cost;          // the accumulated cost of this node
-   m_visited = visited;         // not visited when created (but can be overriden for the source node)
-   
-   m_nodeNumber = nodeNumber;   // this node's number
-   m_viaNode = nodeNumber;      // the node number that this node was reached from (start with self)
-   m_numEdges = 0;              // there are no edges to start
 
-   //   std::cout << "Node number " << nodeNumber << " added" << std::endl;
+private:
+   struct edgeRecord
+   {
+      unsigned long long m_key;    // (source node << 32) | dest node, which is what we sort on
+      unsigned int m_seq;          // the order in which the edge was added
+      unsigned int m_weight;       // the edge cost
+   };
 
-}
+   static const unsigned int RADIX_BITS = 11;   // the most bits of the key sorted on in one pass
 
-bool graphPoint::modifyPoint (int cost, bool visited = false)
-{
-   m_totalCost = cost;
-   m_visited = visited;
-}
+   std::vector<unsigned int> m_nodes;  // all the nodes to be added
+   std::vector<edgeRecord> m_edges;    // all the edges to be added, in the order they were given
+   unsigned int m_numThreads;          // number of threads to sort and emit with
 
-void graphPoint::setVisited ()
-{
-   m_visited = true;
-}
+   void radixSort(std::vector<edgeRecord> &records);
+   size_t collapseDuplicates();
+   template <typename NodeExists>
+   void dropReverseEdges(size_t numUnique, NodeExists nodeExists, std::vector<char> &keepEdge);
+   void splitByNode(size_t numEdges, unsigned int numThreads, std::vector<size_t> &startEdge);
 
-bool graphPoint::getVisited ()
+public:
+   GraphBuilder(unsigned int numThreads);
+   void reserve(unsigned int numNodes, unsigned int numEdges);
+   void addNode(unsigned int nodeNumber);
+   void addEdge(unsigned int sourceNodeNumber, unsigned int destNodeNumber, unsigned int edgeWeight);
+   unsigned int build(Graph &G);   // returns the number of edges that made it into the graph
+   GraphSnapshot *buildSnapshot(unsigned int version);   // the caller deletes the snapshot
+   void clear();
+};
+
+//-------------------------------------------------------------------------------------------------------
+//  Scratch space for searching a GraphSnapshot.  The arrays are kept between searches and every entry is
+//  stamped with the search it belongs to, so starting a new search doesn't have to clear all V of them
+//-------------------------------------------------------------------------------------------------------
+//
+class SearchWorkspace
 {
-   return m_visited;
-}
 
+   friend class GraphSnapshot;
+   friend class ReachabilityIndex;
+   friend class ShardedGraph;
 
-int graphPoint::getPointCost ()
-{
-   return m_totalCost;
-}
+private:
+   std::vector<unsigned int> m_reachedStamp;  // m_cost and m_viaNode are only valid if this == m_stamp
+   std::vector<unsigned int> m_settledStamp;  // the node's cost is final if this == m_stamp
+   std::vector<unsigned int> m_blockedStamp;  // the search mustn't go through the node if this == m_stamp
+   std::vector<int> m_cost;                   // total path cost to each node
+   std::vector<unsigned int> m_viaNode;       // the "from node" (index) for the m_cost recorded
+   std::vector< std::pair<int, unsigned int> > m_openSet;   // a heap of (cost, node index)
+   unsigned int m_stamp;                      // the current search
 
-void graphPoint::setPointCost (int cost)
-{
-   m_totalCost = cost;
-}
+public:
+   SearchWorkspace();
+   void startSearch(unsigned int numNodes);
+   bool isReached(unsigned int index);
+   bool isSettled(unsigned int index);
+   bool isBlocked(unsigned int index);
+   int getCost(unsigned int index);
+   bool reachNode(unsigned int index, int cost, unsigned int viaNode);
+};
 
-void graphPoint::cleanNode()
+//-------------------------------------------------------------------------------------------------------
+//  Scratch space for hop count (breadth first) searches of a GraphSnapshot.  As in SearchWorkspace, each
+//  node is stamped with the search that reached it, so nothing needs clearing between searches
+//-------------------------------------------------------------------------------------------------------
+//
+class BreadthFirstWorkspace
 {
-   m_viaNode = 0;
-   m_totalCost = -1;
-   m_visited = false;
-}
 
+   friend class GraphSnapshot;
 
-void graphPoint::printGraphPoint()
-{
-   std::cout << "Graph point #" << m_nodeNumber
-             << ((m_totalCost == 0) ? " (ORIGIN)" : "")
-             << " has a cost of " 
-             << m_totalCost 
-             << " and has" << (m_visited ? "" : " not") << " been visited" << std::endl;
-   
-   if(m_numEdges) std::cout << "Edge at:" << std::endl;
-   
-   for(std::map<unsigned int, unsigned int>::iterator it=m_edges.begin(); it != m_edges.end(); ++it)
-   {
-      std::cout << "-- to node:" << it->first << " (" << it->second << ")" << std::endl;
-   } 
-}
+private:
+   unsigned int m_numNodes;                                           // how big the arrays are
+   std::unique_ptr< std::atomic<unsigned int>[] > m_reachedStamp;     // claimed by the thread that reaches it first
+   std::vector<unsigned int> m_parent;                                // the node (index) each node was reached from
+   std::unique_ptr< std::atomic<unsigned long long>[] > m_frontierBits;   // the frontier as a bitmap, for bottom up steps
+   std::vector<unsigned int> m_frontier;                              // the frontier as a list, for top down steps
+   std::vector< std::vector<unsigned int> > m_nextFrontier;           // what each thread finds for the next level
+   SearchWorkspace m_reachWork;                                       // for the reachability check
+   unsigned int m_stamp;
 
-// create a new edge to "dest_node" with a cost of "weight"
-void graphPoint::createEdge(unsigned int dest_node, unsigned int weight)
-{
-      std::map<unsigned int, unsigned int>::iterator it;
+public:
+   BreadthFirstWorkspace();
+   void startSearch(unsigned int numNodes, unsigned int numThreads);
+};
 
-      // replace any duplicate entry with a new weight
-      if((it = m_edges.find(dest_node)) != m_edges.end())
-      {
-         // std::cout << "duplicate edge \"dest node\"found: "
-         //           << it->first << ", replacing " << it->second 
-         //           << " with " << weight << std::endl;
+//-------------------------------------------------------------------------------------------------------
+//  Answers "is there any route from A to B?" without searching the graph.  The strongly connected
+//  components are found with (iterative) Tarjan, and collapsed into a DAG.  Each DAG node gets interval
+//  labels from two post-order walks (GRAIL): if A can reach B, B's intervals sit inside A's, so most
+//  "no" answers take O(1).  When the labels can't rule it out, a DFS of the DAG, pruned by the labels,
+//  decides.  Nodes are snapshot indexes
+//-------------------------------------------------------------------------------------------------------
+//
+class ReachabilityIndex
+{
 
-         it->second = weight;
-         return;
-      }
+private:
+   static const unsigned int NUM_WALKS = 2;   // how many label intervals each component gets
 
-      // otherwise, insert a new edge in the set of all edges from this node
-      else
-      {
-         m_edges.insert(std::pair<unsigned int,unsigned int>(dest_node, weight));
-         m_numEdges++;
-      }
-}
+   std::vector<unsigned int> m_component;     // the component of each node.  Tarjan numbers them in reverse
+                                              // topological order, so an edge always goes to a lower number
+   std::vector<unsigned int> m_dagStart;      // the DAG edges from component c are m_dagStart[c] .. m_dagStart[c+1]-1
+   std::vector<unsigned int> m_dagDest;
+   std::vector<unsigned int> m_labels;        // (lowest rank below, own rank) for each walk, for each component
+   std::vector<unsigned int> m_componentSize; // the number of nodes in each component
 
-// remove the edge to "dest_node"
-int graphPoint::deleteEdge(unsigned int dest_node)
-{
-   int retval = -1;
-   std::map<unsigned int, unsigned int>::iterator it;
-   
-   // find and delete the edge.  If not found, do nothing
-   if((it = m_edges.find(dest_node)) != m_edges.end())
-   {
-      std::cout << "\"dest node\"found: "
-                << it->first << ", erasing edge to it " << it->second 
-                << std::endl;
-      
-      m_edges.erase(it);
-      m_numEdges--;
-      retval = 0;
-   }
+   bool labelsContain(unsigned int outer, unsigned int inner) const;
 
-   return retval;
-   
-}
+public:
+   void build(const std::vector<unsigned int> &edgeStart, const std::vector<unsigned int> &edgeDest);
+   unsigned int getComponentCount() const;
+   unsigned int getComponent(unsigned int index) const;
+   unsigned int getComponentSize(unsigned int component) const;
+   bool canReach(unsigned int originIndex, unsigned int destIndex, SearchWorkspace &work) const;
+};
 
-// modify the edge to "dest_node"
-//
-// return -1 if error, 0 if ok.
+//-------------------------------------------------------------------------------------------------------
+//  A read-only copy of a Graph, with the edges packed into flat arrays (nodes are numbered 0..V-1 by
+//  position).  Nothing changes a snapshot once it's built, so any number of threads can search it at once
+//-------------------------------------------------------------------------------------------------------
 //
-int graphPoint::modifyEdge(unsigned int dest_node, unsigned int weight)
+class GraphSnapshot
 {
-   int retval = -1;
-   std::map<unsigned int, unsigned int>::iterator it;
-   
-   // find and delete the edge.  If not found, do nothing
-   if((it = m_edges.find(dest_node)) != m_edges.end())
-   {
-      // std::cout << "\"dest node\"found: "
-      //           << it->first << ", modifying the edge to " << it->second 
-      //           << std::endl;
-      
-      it->second = weight;
-      return 0;
-   }
 
-   return -1;
+   friend class GraphBuilder;
+   friend class ShardedGraph;
+   friend class VersionedGraph;
 
-}
+private:
+   // everything but the edge weights.  A snapshot that only re-weights edges shares this with the one
+   // before it, rather than building it all again
+   struct snapshotTopology
+   {
+      std::vector<int> m_nodeNumbers;
+      std::vector<unsigned int> m_edgeStart;
+      std::vector<unsigned int> m_edgeDest;
+      std::vector<unsigned int> m_reverseStart;
+      std::vector<unsigned int> m_reverseDest;
+      ReachabilityIndex m_reach;
+   };
+
+   std::shared_ptr<snapshotTopology> m_topology;
+   const std::vector<int> &m_nodeNumbers;            // the node number of each index, in order
+   const std::vector<unsigned int> &m_edgeStart;     // the edges from index i are m_edgeStart[i] .. m_edgeStart[i+1]-1
+   const std::vector<unsigned int> &m_edgeDest;      // the dest index of each edge
+   std::vector<unsigned int> m_edgeWeight;           // the cost of each edge
+   const std::vector<unsigned int> &m_reverseStart;  // the same again with every edge turned around, for searching
+   const std::vector<unsigned int> &m_reverseDest;   //   backwards (m_reverseDest is the source of the real edge)
+   std::vector<unsigned int> m_reverseWeight;
+   unsigned int m_version;                           // which version of the graph this is
+   const ReachabilityIndex &m_reach;                 // which nodes can reach which
+
+   GraphSnapshot(const GraphSnapshot &previous, unsigned int version);
+   explicit GraphSnapshot(unsigned int version);
+   void buildReverseEdges();
+   void setEdgeValue(unsigned int sourceNodeNumber, unsigned int destNodeNumber, unsigned int weight);
+
+   void beginSearch(unsigned int originIndex, SearchWorkspace &work) const;
+   int settleNext(SearchWorkspace &work, int maxCost, bool backward) const;
+   int spurSearch(const std::vector<unsigned int> &route, unsigned int position, const std::vector<unsigned int> &removedNext,
+                  int maxCost, SearchWorkspace &tree, SearchWorkspace &work, std::vector<unsigned int> &spurPath) const;
 
-// get the edge to "dest_node"
-//
-// return -1 if error, edge weight if ok
+public:
+   GraphSnapshot(Graph &G, unsigned int version);
+   unsigned int getNodeCount() const;
+   unsigned int getEdgeCount() const;
+   unsigned int getVersion() const;
+   int findNode(unsigned int nodeNumber) const;    // returns the index of the node, or -1 if it doesn't exist
+   unsigned int getNodeNumber(unsigned int index) const;
+   unsigned int getOutDegree(unsigned int index) const;
+   unsigned int getInDegree(unsigned int index) const;
+   const ReachabilityIndex &getReachability() const;
+   bool canReach(unsigned int originNode, unsigned int destNode, SearchWorkspace &work) const;
+   void doDijkstra(unsigned int originNode, unsigned int destNode, SearchWorkspace &work,
+                   std::list<unsigned int> *pathResult, int &pathCost) const;
+   void doDijkstra(unsigned int originNode, const std::vector<unsigned int> &destNodes, SearchWorkspace &work,
+                   std::vector<int> &pathCosts) const;
+   void doDistanceTable(const std::vector<unsigned int> &originNodes, const std::vector<unsigned int> &destNodes,
+                        std::vector<SearchWorkspace> &works, unsigned int numThreads, std::vector<int> &pathCosts) const;
+   void doDijkstraWithin(unsigned int originNode, int maxCost, SearchWorkspace &work,
+                         std::vector<settledNode> &settledNodes) const;
+   void searchAll(unsigned int originIndex, bool backward, SearchWorkspace &work,
+                  std::vector<unsigned int> &closedNodes) const;
+   void doBreadthFirst(unsigned int originNode, unsigned int destNode, BreadthFirstWorkspace &work,
+                       unsigned int numThreads, std::list<unsigned int> *pathResult, int &pathCost) const;
+   void doKShortest(unsigned int originNode, unsigned int destNode, unsigned int k, std::vector<SearchWorkspace> &works,
+                    unsigned int numThreads, std::vector<alternativePath> &paths) const;
+};
+
+//-------------------------------------------------------------------------------------------------------
+//  A graph that can be changed while other threads are searching it.  Writers queue up changes and
+//  publish() them as a new GraphSnapshot; readers hold a GraphReadGuard, which pins the current snapshot
+//  without ever taking a lock.  A replaced snapshot is deleted once no reader can still be holding it.
+//  A publish() that only re-weights edges shares everything but the weights with the snapshot before it.
+//-------------------------------------------------------------------------------------------------------
 //
-int graphPoint::getEdgeValue(unsigned int node)
+class VersionedGraph
 {
-      int retval = -1;
-      std::map<unsigned int, unsigned int>::iterator it;
-
-      // std::cout << "Finding edge cost from " << m_nodeNumber << " to " << node << std::endl;
 
-      // find the edge.  If not found, return a cost of -1 (this mean infinity)
-      if((it = m_edges.find(node)) != m_edges.end())
-      {
+   friend class GraphReadGuard;
 
-         // std::cout << "Found a cost of : " << it->second << std::endl;
+private:
+   static const unsigned int MAX_READERS = 128;   // readers that can hold a snapshot at the same time
 
-         retval = (it->second);
-      }
+   enum changeType { ADD_NODE, ADD_EDGE, SET_EDGE_VALUE };
 
-      // std::cout << "done" << std::endl;
+   struct graphChange
+   {
+      changeType m_type;
+      unsigned int m_sourceNodeNumber;      // (or the node number for ADD_NODE)
+      unsigned int m_destNodeNumber;
+      unsigned int m_weight;
+   };
+
+   Graph m_graph;                              // the latest graph, only touched while holding m_publishLock
+   std::vector<graphChange> m_pendingChanges;  // changes not yet published, guarded by m_pendingLock
+   std::mutex m_pendingLock;
+   std::mutex m_publishLock;
+   unsigned int m_version;                     // version number of the latest snapshot
+
+   std::atomic<GraphSnapshot *> m_current;     // the snapshot that new readers get
+   std::atomic<unsigned long> m_epoch;         // bumped every time a snapshot is replaced
+   std::atomic<unsigned long> m_readerEpoch[MAX_READERS];   // the epoch each reader started in, 0 if unused
+   std::atomic<unsigned long> m_numOverflowReaders;         // readers that found every slot taken
+   std::vector< std::pair<GraphSnapshot *, unsigned long> > m_retired;   // replaced snapshots and when
+
+   void queueChange(changeType type, unsigned int sourceNodeNumber, unsigned int destNodeNumber, unsigned int weight);
+   unsigned int publishChanges(GraphBuilder *bulk);
+   void reclaimRetired();      // reclaim(), with m_publishLock already held
 
-      return retval;
+public:
+   VersionedGraph();
+   ~VersionedGraph();
+   void addNode(unsigned int nodeNumber);
+   void addEdge(unsigned int sourceNodeNumber, unsigned int destNodeNumber, unsigned int edgeWeight);
+   void setEdgeValue(unsigned int sourceNodeNumber, unsigned int destNodeNumber, unsigned int weight);
+   unsigned int publish();     // apply the queued changes and make them visible, returns the new version
+   unsigned int publish(GraphBuilder &builder);   // the same, then load everything in the builder too
+   void reclaim();             // delete any replaced snapshots that no reader can be holding
+};
 
-}
+//-------------------------------------------------------------------------------------------------------
+//  Pins the current snapshot of a VersionedGraph for as long as it's in scope
+//-------------------------------------------------------------------------------------------------------
+//
+class GraphReadGuard
+{
+private:
+   VersionedGraph &m_graph;
+   unsigned int m_slot;               // our entry in m_graph.m_readerEpoch, MAX_READERS if an overflow reader
+   GraphSnapshot *m_snapshot;
 
+public:
+   GraphReadGuard(VersionedGraph &G);
+   ~GraphReadGuard();
+   const GraphSnapshot &snapshot();
+};
 
-//*****************************************************************
-//**
-//** Graph methods
-//**
-//*****************************************************************
+//-------------------------------------------------------------------------------------------------------
+//  Statistics about a whole graph: the average route cost (and how route costs are spread), the
+//  eccentricity of nodes, and the diameter.  The average is estimated from full searches from a random
+//  sample of sources, run in parallel, until it's known to within a given error.  The diameter is worked
+//  out exactly for the largest strongly connected component, using the iFUB bounds for directed graphs,
+//  and stops early (giving a range) if it would take too many searches
+//-------------------------------------------------------------------------------------------------------
 //
-
-Graph::Graph()
+class GraphAnalytics
 {
-   m_totalNumVerticies = 0;
-   m_totalNumEdges = 0;
-}
+private:
+   static const unsigned int MAX_COST_BINS = 1024;   // for the route cost distribution
+
+   const GraphSnapshot &m_graph;
+   unsigned int m_numThreads;
+   std::vector<SearchWorkspace> m_work;           // one per thread
+
+   std::vector<unsigned int> m_sourceOrder;       // every node index, shuffled, so sources are sampled without repeats
+   unsigned int m_numSources;                     // how many of m_sourceOrder have been searched from
+   std::vector<double> m_sourceCostSums;          // for each source searched, the sum of its route costs
+   std::vector<unsigned int> m_sourceRouteCounts; //   and how many routes there were
+   std::vector<int> m_sourceEccentricities;       //   and the cost of the longest one
+   unsigned long long m_numRoutes;                //   and all of them together
+   std::vector<unsigned long long> m_costCounts;  // how many of all the routes sampled fell in each bin of costs,
+   unsigned int m_costBinWidth;                   //   which are this many costs wide
+
+   int m_diameterLow;                             // the diameter of the largest component is somewhere
+   int m_diameterHigh;                            //   between these two (-1 if not computed)
+   unsigned int m_diameterComponentSize;
+   unsigned int m_diameterSearches;               // how many searches it took
+
+   int findEccentricity(unsigned int index, bool backward, unsigned int component, SearchWorkspace &work);
+   static void widenCostBins(std::vector<unsigned long long> &costCounts, unsigned int &binWidth, unsigned int newWidth);
+   static void countCost(std::vector<unsigned long long> &costCounts, unsigned int &binWidth, unsigned int cost, unsigned long long count);
 
-// add a node to the graph
-void Graph::addNode(unsigned int nodeNumber)
-{
-   graphNodes[nodeNumber] = new graphPoint(nodeNumber);
-   m_totalNumVerticies++;
-   m_originNode = -1;
-}
+public:
+   GraphAnalytics(const GraphSnapshot &S, unsigned int numThreads);
+   void estimateAverageCost(double relativeError, unsigned int maxSources);
+   void computeDiameter(unsigned int maxSearches);
+   double getAverageCost();
+   double getAverageCostError();                  // the 95% confidence interval is the average +/- this
+   int getDiameterLow();
+   int getDiameterHigh();
+   void printReport();
+};
 
-// // remove a node to the graph (but only if it exists)
-// void Graph::removeNode(unsigned int nodeNumber)
-// {
-//    std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+//-------------------------------------------------------------------------------------------------------
+//  The wire format for the query server.  Every request and response is one fixed size frame, in host
+//  byte order (the server only takes local clients)
+//-------------------------------------------------------------------------------------------------------
+//
+struct queryRequestFrame
+{
+   unsigned int m_requestId;     // chosen by the client, and handed back in the response
+   unsigned int m_originNode;
+   unsigned int m_destNode;
+};
 
-//    if( it != graphNodes.end())
-//    {
-//       graphNodes.erase(it);
-//       m_totalNumVerticies--;
-//    }
-// }
+struct queryResponseFrame
+{
+   unsigned int m_requestId;
+   int m_pathCost;               // the path cost, or (-1) if no path exists
+};
 
+// a client of the query server.  The fds are closed once the client has stopped sending and every answer
+// for it has been written
+struct queryConnection
+{
+   int m_readFd;
+   int m_writeFd;
+   std::vector<queryResponseFrame> m_answered;    // answered in the current batch (only the engine touches this)
+
+   std::mutex m_lock;                             // guards everything below
+   std::condition_variable m_wake;                // the connection's reader and writer wait on this
+   std::vector<queryResponseFrame> m_backlog;     // answered but not yet written
+   unsigned int m_numPending;                     // queued but not yet answered
+   bool m_readerDone;                             // the client has stopped sending
+   bool m_failed;                                 // the client went away or fell too far behind, so answers are dropped
+
+   queryConnection(int readFd, int writeFd);
+   ~queryConnection();
+};
 
-void Graph::addEdge(unsigned int sourceNodeNumber, unsigned int destNodeNumber, unsigned int edgeWeight)
+//-------------------------------------------------------------------------------------------------------
+//  A lock-free queue of queries waiting for the engine.  Any number of threads can push(), but only one
+//  thread may pop()
+//-------------------------------------------------------------------------------------------------------
+//
+class QueryQueue
 {
-   std::map<int, graphPoint* >::iterator it_s = graphNodes.find(sourceNodeNumber);
-   std::map<int, graphPoint* >::iterator it_d = graphNodes.find(destNodeNumber);
 
-   if( it_s != graphNodes.end())
+public:
+   struct queryItem
    {
-      // don't add an edge leading to any dest node that already has an edge back to the source (unidirectional graph)
-      if((it_d == graphNodes.end()) || (it_d->second->getEdgeValue(sourceNodeNumber) == (-1)))
-      {
-         it_s->second->createEdge(destNodeNumber, edgeWeight);
-         m_totalNumEdges++;
-      }
-   }
-}
+      std::atomic<queryItem *> m_next;
+      queryRequestFrame m_request;
+      std::shared_ptr<queryConnection> m_connection;   // where the answer goes
+   };
 
+private:
+   queryItem m_stub;                  // always somewhere in the queue, so it's never really empty
+   std::atomic<queryItem *> m_head;   // the last item pushed
+   queryItem *m_tail;                 // the next item to pop
+
+public:
+   QueryQueue();
+   void push(queryItem *item);
+   queryItem *pop();    // returns NULL if there's nothing to pop.  The caller deletes the item
+};
+
+//-------------------------------------------------------------------------------------------------------
+//  Answers path_size queries from local clients on a VersionedGraph.  One thread per client reads the
+//  requests and queues them, and a single engine thread answers them in batches: all the queries in a
+//  batch with the same origin are answered by one search, and the searches are shared out over a few
+//  worker threads.  Answers go back as soon as their batch is done,
+//  so they can arrive in a different order than the requests were sent.  Another thread per client writes
+//  the answers, so a client that stops reading only holds itself up, never the engine.  A client can only
+//  have so many queries queued at once, so one that floods the server is held back by its own socket
+//  rather than getting ahead of everyone else
+//-------------------------------------------------------------------------------------------------------
+//
+class QueryServer
+{
+private:
+   static const unsigned int MAX_BACKLOG = 1 << 20;   // how many answers a client can fall behind before it's dropped
+   static const unsigned int MAX_PENDING = 1024;      // how many queries a client can have queued before its reader waits
+
+   VersionedGraph &m_graph;
+   QueryQueue m_queue;
+   unsigned int m_maxBatch;                // the most queries the engine takes at once
+   unsigned int m_numThreads;              // the most threads a batch's searches are run on
+   std::vector<SearchWorkspace> m_works;   // scratch space for the searches, one per thread
+
+   std::atomic<unsigned int> m_numQueued;  // pushed but not yet popped
+   std::atomic<bool> m_engineSleeping;
+   std::atomic<bool> m_stopping;           // the engine stops once the queue is empty
+   std::mutex m_wakeLock;
+   std::condition_variable m_wake;
+
+   std::mutex m_clientsLock;
+   std::condition_variable m_clientsDone;
+   unsigned int m_numClientThreads;        // socket readers and writers still running (guarded by m_clientsLock)
+
+   void readRequests(std::shared_ptr<queryConnection> connection);
+   void writeResponses(std::shared_ptr<queryConnection> connection);
+   void runClientThread(void (QueryServer::*work)(std::shared_ptr<queryConnection>), std::shared_ptr<queryConnection> connection);
+   void runEngine();
+
+public:
+   QueryServer(VersionedGraph &G, unsigned int maxBatch, unsigned int numThreads);
+   int serveSocket(const char *socketPath);   // returns -1 if the socket can't be set up, or once every client has been stopped
+                                              // after it fails.  Otherwise never returns
+   void serveStream(int readFd, int writeFd); // serves a single client over a pair of pipes, until end of input
+};
+
+//-------------------------------------------------------------------------------------------------------
+//  A client for the query server that sends random queries at a fixed rate and reports the latencies
+//-------------------------------------------------------------------------------------------------------
+//
+class QueryLoadGenerator
+{
+private:
+   std::vector<long long> m_latencies;    // in nanoseconds, one per answer received
+
+   void printReport(double elapsedSeconds);
+
+public:
+   int run(const char *socketPath, unsigned int numNodes, unsigned int numRequests, unsigned int requestsPerSecond);
+};
+
+//-------------------------------------------------------------------------------------------------------
+//  The messages between a ShardedGraph and its shard processes.  Each one is a shardMessage, followed by
+//  m_count records (shardUpdates for a search step, node indexes for a trace)
+//-------------------------------------------------------------------------------------------------------
+//
+struct shardMessage
+{
+   unsigned int m_type;
+   unsigned int m_count;
+   int m_value;                  // depends on the type
+};
+
+struct shardUpdate
+{
+   unsigned int m_node;          // the (global) index of the node reached
+   unsigned int m_viaNode;       // the index it was reached from
+   int m_pathCost;
+};
+
+// one shard's piece of the graph: a run of nodes, and all of the edges out of them
+struct graphShard
+{
+   unsigned int m_firstNode;                 // the global index of the first node in the shard
+   std::vector<unsigned int> m_edgeStart;    // by local index (global index - m_firstNode)
+   std::vector<unsigned int> m_edgeDest;     // the global index of each dest node
+   std::vector<unsigned int> m_edgeWeight;
+};
+
+//-------------------------------------------------------------------------------------------------------
+//  A graph split across processes, one per shard, as a stand-in for a graph too big for one machine.  Each
+//  node belongs to exactly one shard (edges between shards are "cut"), and the shards find shortest paths
+//  together in supersteps: each one runs Dijkstra over its own nodes from whatever updates it was sent, and
+//  the costs it finds for other shards' nodes go out, through this process, as the next step's updates.
+//  Make it before starting any threads, since the shards are forked off
+//-------------------------------------------------------------------------------------------------------
+//
+class ShardedGraph
+{
+
+public:
+   enum messageType { SHARD_NEW_SEARCH, SHARD_STEP, SHARD_TRACE, SHARD_QUIT };
+
+private:
+   std::vector<int> m_nodeNumbers;             // the node number of each global index, in order
+   std::vector<unsigned int> m_shardStart;     // shard s has global indexes m_shardStart[s] .. m_shardStart[s+1]-1
+   std::vector<int> m_shardFds;                // our end of each shard's socket (empty if the shards are gone)
+   std::vector<pid_t> m_shardPids;
+   unsigned long long m_numEdges;
+   unsigned long long m_numCutEdges;
+   unsigned long long m_numSupersteps;         // over all the searches so far
+   unsigned long long m_bytesExchanged;
+
+   int findIndex(unsigned int nodeNumber) const;   // returns the global index of the node, or -1 if it doesn't exist
+   unsigned int findShard(unsigned int index) const;
+   template<typename Record> bool sendToShard(unsigned int shard, unsigned int type, int value, const std::vector<Record> &records);
+   template<typename Record> bool receiveFromShard(unsigned int shard, shardMessage &message, std::vector<Record> &records);
+   void stopShards();
+   static void runShard(int fd, const graphShard &shard);
+
+public:
+   ShardedGraph(Graph &G, unsigned int numShards);
+   ~ShardedGraph();
+   bool isRunning() const;                     // false if the shards couldn't be started, or one has died
+   unsigned int getShardCount() const;
+   unsigned long long getEdgeCount() const;
+   unsigned long long getCutEdgeCount() const;
+   unsigned long long getSuperstepCount() const;
+   unsigned long long getBytesExchanged() const;
+   void doDijkstra(unsigned int originNode, unsigned int destNode, std::list<unsigned int> *pathResult, int &pathCost);
+};
+ 
+//*****************************************************************
+//**
+//** NodeNumberSet methods
+//**
+//*****************************************************************
+
+const unsigned int NodeNumberSet::EMPTY;
+
+NodeNumberSet::NodeNumberSet()
+{
+   m_size = 0;
+}
+
+// where the probe for a node number starts (a multiplicative hash, so runs of node numbers spread out)
+unsigned int NodeNumberSet::homeSlot(unsigned int nodeNumber) const
+{
+   unsigned int hash = nodeNumber * 2654435769u;
+
+   return (hash ^ (hash >> 16)) & (m_slots.size() - 1);
+}
+
+// move every member into a table of numSlots (a power of 2, or 0 if there are no members)
+void NodeNumberSet::rehash(unsigned int numSlots)
+{
+   std::vector<unsigned int> oldSlots(numSlots, EMPTY);
+
+   m_slots.swap(oldSlots);
+
+   for(unsigned int i=0; i<oldSlots.size(); i++)
+   {
+      if(oldSlots[i] == EMPTY) continue;
+
+      unsigned int slot = homeSlot(oldSlots[i]);
+
+      while(m_slots[slot] != EMPTY) slot = (slot + 1) & (m_slots.size() - 1);
+
+      m_slots[slot] = oldSlots[i];
+   }
+}
+
+unsigned int NodeNumberSet::size() const
+{
+   return m_size;
+}
+
+bool NodeNumberSet::empty() const
+{
+   return (m_size == 0);
+}
+
+bool NodeNumberSet::contains(unsigned int nodeNumber) const
+{
+   if(m_size == 0) return false;
+
+   for(unsigned int slot = homeSlot(nodeNumber); m_slots[slot] != EMPTY; slot = (slot + 1) & (m_slots.size() - 1))
+   {
+      if(m_slots[slot] == nodeNumber) return true;
+   }
+
+   return false;
+}
+
+// make room for numMembers in all without growing again
+void NodeNumberSet::reserve(unsigned int numMembers)
+{
+   unsigned int numSlots = 4;
+
+   while(numSlots * 3 < numMembers * 4) numSlots *= 2;
+
+   if(numSlots > m_slots.size()) rehash(numSlots);
+}
+
+void NodeNumberSet::insert(unsigned int nodeNumber)
+{
+   if(contains(nodeNumber)) return;
+
+   reserve(m_size + 1);
+
+   unsigned int slot = homeSlot(nodeNumber);
+
+   while(m_slots[slot] != EMPTY) slot = (slot + 1) & (m_slots.size() - 1);
+
+   m_slots[slot] = nodeNumber;
+   m_size++;
+}
+
+void NodeNumberSet::erase(unsigned int nodeNumber)
+{
+   if(m_size == 0) return;
+
+   unsigned int mask = m_slots.size() - 1;
+   unsigned int slot = homeSlot(nodeNumber);
+
+   while(m_slots[slot] != nodeNumber)
+   {
+      if(m_slots[slot] == EMPTY) return;
+
+      slot = (slot + 1) & mask;
+   }
+
+   // close the gap: pull back any later member of the run that would no longer be found past it
+   unsigned int next = slot;
+
+   while(true)
+   {
+      next = (next + 1) & mask;
+
+      if(m_slots[next] == EMPTY) break;
+
+      if(((next - homeSlot(m_slots[next])) & mask) >= ((next - slot) & mask))
+      {
+         m_slots[slot] = m_slots[next];
+         slot = next;
+      }
+   }
+
+   m_slots[slot] = EMPTY;
+   m_size--;
+
+   // give the memory back once it's mostly empty (a removed hub shouldn't keep its table)
+   if(m_size == 0) std::vector<unsigned int>().swap(m_slots);
+   else if((m_slots.size() > 8) && (m_size * 8 < m_slots.size())) rehash(m_slots.size() / 4);
+}
+
+void NodeNumberSet::swap(NodeNumberSet &other)
+{
+   m_slots.swap(other.m_slots);
+   std::swap(m_size, other.m_size);
+}
+
+NodeNumberSet::const_iterator NodeNumberSet::begin() const
+{
+   return const_iterator(m_slots.data(), m_slots.data() + m_slots.size());
+}
+
+NodeNumberSet::const_iterator NodeNumberSet::end() const
+{
+   return const_iterator(m_slots.data() + m_slots.size(), m_slots.data() + m_slots.size());
+}
+
+
+//*****************************************************************
+//**
+//** graphPoint methods
+//**
+//*****************************************************************
+
+
+graphPoint::graphPoint( unsigned int nodeNumber, int cost = (-1), bool visited = false )
+{
+   m_totalCost = cost;          // the accumulated cost of this node
+   m_visited = visited;         // not visited when created (but can be overriden for the source node)
+   
+   m_nodeNumber = nodeNumber;   // this node's number
+   m_viaNode = nodeNumber;      // the node number that this node was reached from (start with self)
+   m_numEdges = 0;              // there are no edges to start
+
+   //   std::cout << "Node number " << nodeNumber << " added" << std::endl;
+
+}
+
+bool graphPoint::modifyPoint (int cost, bool visited = false)
+{
+   m_totalCost = cost;
+   m_visited = visited;
+   return true;
+}
+
+void graphPoint::setVisited ()
+{
+   m_visited = true;
+}
+
+bool graphPoint::getVisited ()
+{
+   return m_visited;
+}
+
+
+int graphPoint::getPointCost ()
+{
+   return m_totalCost;
+}
+
+void graphPoint::setPointCost (int cost)
+{
+   m_totalCost = cost;
+}
+
+void graphPoint::cleanNode()
+{
+   m_viaNode = 0;
+   m_totalCost = -1;
+   m_visited = false;
+}
+
+
+void graphPoint::printGraphPoint()
+{
+   std::cout << "Graph point #" << m_nodeNumber
+             << ((m_totalCost == 0) ? " (ORIGIN)" : "")
+             << " has a cost of " 
+             << m_totalCost 
+             << " and has" << (m_visited ? "" : " not") << " been visited" << std::endl;
+   
+   if(m_numEdges) std::cout << "Edge at:" << std::endl;
+   
+   for(std::map<unsigned int, unsigned int>::iterator it=m_edges.begin(); it != m_edges.end(); ++it)
+   {
+      std::cout << "-- to node:" << it->first << " (" << it->second << ")" << std::endl;
+   } 
+}
+
+// create a new edge to "dest_node" with a cost of "weight"
+void graphPoint::createEdge(unsigned int dest_node, unsigned int weight)
+{
+      std::map<unsigned int, unsigned int>::iterator it;
+
+      // replace any duplicate entry with a new weight
+      if((it = m_edges.find(dest_node)) != m_edges.end())
+      {
+         // std::cout << "duplicate edge \"dest node\"found: "
+         //           << it->first << ", replacing " << it->second 
+         //           << " with " << weight << std::endl;
+
+         it->second = weight;
+         return;
+      }
+
+      // otherwise, insert a new edge in the set of all edges from this node
+      else
+      {
+         m_edges.insert(std::pair<unsigned int,unsigned int>(dest_node, weight));
+         m_numEdges++;
+      }
+}
+
+// remove the edge to "dest_node"
+int graphPoint::deleteEdge(unsigned int dest_node)
+{
+   int retval = -1;
+   std::map<unsigned int, unsigned int>::iterator it;
+   
+   // find and delete the edge.  If not found, do nothing
+   if((it = m_edges.find(dest_node)) != m_edges.end())
+   {
+      // std::cout << "\"dest node\"found: "
+      //           << it->first << ", erasing edge to it " << it->second 
+      //           << std::endl;
+      
+      m_edges.erase(it);
+      m_numEdges--;
+      retval = 0;
+   }
+
+   return retval;
+   
+}
+
+// modify the edge to "dest_node"
+//
+// return -1 if error, 0 if ok.
+//
+int graphPoint::modifyEdge(unsigned int dest_node, unsigned int weight)
+{
+   int retval = -1;
+   std::map<unsigned int, unsigned int>::iterator it;
+   
+   // find and delete the edge.  If not found, do nothing
+   if((it = m_edges.find(dest_node)) != m_edges.end())
+   {
+      // std::cout << "\"dest node\"found: "
+      //           << it->first << ", modifying the edge to " << it->second 
+      //           << std::endl;
+      
+      it->second = weight;
+      return 0;
+   }
+
+   return -1;
+
+}
+
+// is there an edge from "source_node" to this node?
+bool graphPoint::hasInEdge(unsigned int source_node)
+{
+   return m_inEdges.contains(source_node);
+}
+
+// record an edge from "source_node" to this node
+void graphPoint::addInEdge(unsigned int source_node)
+{
+   m_inEdges.insert(source_node);
+}
+
+void graphPoint::removeInEdge(unsigned int source_node)
+{
+   m_inEdges.erase(source_node);
+}
+
+// get the edge to "dest_node"
+//
+// return -1 if error, edge weight if ok
+//
+int graphPoint::getEdgeValue(unsigned int node)
+{
+      int retval = -1;
+      std::map<unsigned int, unsigned int>::iterator it;
+
+      // std::cout << "Finding edge cost from " << m_nodeNumber << " to " << node << std::endl;
+
+      // find the edge.  If not found, return a cost of -1 (this mean infinity)
+      if((it = m_edges.find(node)) != m_edges.end())
+      {
+
+         // std::cout << "Found a cost of : " << it->second << std::endl;
+
+         retval = (it->second);
+      }
+
+      // std::cout << "done" << std::endl;
+
+      return retval;
+
+}
+
+
+//*****************************************************************
+//**
+//** Graph methods
+//**
+//*****************************************************************
+//
+
+Graph::Graph()
+{
+   m_totalNumVerticies = 0;
+   m_totalNumEdges = 0;
+   m_snapshot = NULL;
+   m_reachWork = new SearchWorkspace;
+}
+
+Graph::~Graph()
+{
+   for(std::map<int, graphPoint* >::iterator it = graphNodes.begin(); it != graphNodes.end(); ++it)
+   {
+      delete it->second;
+   }
+
+   delete m_snapshot;
+   delete m_reachWork;
+}
+
+void Graph::invalidateSnapshot()
+{
+   delete m_snapshot;
+   m_snapshot = NULL;
+}
+
+const GraphSnapshot &Graph::getSnapshot()
+{
+   if(m_snapshot == NULL) m_snapshot = new GraphSnapshot(*this, 0);
+
+   return *m_snapshot;
+}
+
+// is there any route at all from originNode to destNode?  Mostly O(1), from the snapshot's reachability index,
+// but if the graph has changed since the snapshot was made this builds it again first, for O(V+E)
+bool Graph::canReach(unsigned int originNode, unsigned int destNode)
+{
+   return getSnapshot().canReach(originNode, destNode, *m_reachWork);
+}
+
+// add a node to the graph (a node that's already there keeps its edges)
+void Graph::addNode(unsigned int nodeNumber)
+{
+   std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+
+   if( it != graphNodes.end()) return;
+
+   graphPoint *node = new graphPoint(nodeNumber);
+
+   graphNodes[nodeNumber] = node;
+   m_totalNumVerticies++;
+   m_originNode = -1;
+   invalidateSnapshot();
+
+   adoptDanglingInEdges(node);
+}
+
+// a new node picks up any edges that were made to it before it existed
+void Graph::adoptDanglingInEdges(graphPoint *node)
+{
+   std::map<unsigned int, NodeNumberSet>::iterator itDangling = m_danglingInEdges.find(node->m_nodeNumber);
+
+   if(itDangling != m_danglingInEdges.end())
+   {
+      node->m_inEdges.swap(itDangling->second);
+      m_danglingInEdges.erase(itDangling);
+   }
+}
+
+// remove a node from the graph (but only if it exists), along with every edge to or from it
+void Graph::removeNode(unsigned int nodeNumber)
+{
+   std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+
+   if( it == graphNodes.end()) return;
+
+   graphPoint *node = it->second;
+
+   // the edges from it: the nodes they lead to forget about them
+   for(std::map<unsigned int, unsigned int>::iterator itGraphEdge = node->m_edges.begin(); itGraphEdge != node->m_edges.end(); ++itGraphEdge)
+   {
+      std::map<int, graphPoint* >::iterator it_d = graphNodes.find(itGraphEdge->first);
+
+      if(it_d != graphNodes.end())
+      {
+         it_d->second->removeInEdge(nodeNumber);
+      }
+      else
+      {
+         NodeNumberSet &sources = m_danglingInEdges[itGraphEdge->first];
+
+         sources.erase(nodeNumber);
+
+         if(sources.empty()) m_danglingInEdges.erase(itGraphEdge->first);
+      }
+
+      m_totalNumEdges--;
+   }
+
+   // the edges to it: the nodes they come from drop them.  (An edge to self was taken care of above.)
+   // The set is in hash order, so sort the sources first to look them up in map order
+   std::vector<unsigned int> sources(node->m_inEdges.begin(), node->m_inEdges.end());
+
+   std::sort(sources.begin(), sources.end());
+
+   for(unsigned int i=0; i<sources.size(); i++)
+   {
+      if(!graphNodes.find(sources[i])->second->deleteEdge(nodeNumber)) m_totalNumEdges--;
+   }
+
+   graphNodes.erase(it);
+   delete node;
+   m_totalNumVerticies--;
+
+   if(m_originNode == static_cast<int>(nodeNumber)) m_originNode = -1;
+
+   invalidateSnapshot();
+}
+
+
+void Graph::addEdge(unsigned int sourceNodeNumber, unsigned int destNodeNumber, unsigned int edgeWeight)
+{
+   std::map<int, graphPoint* >::iterator it_s = graphNodes.find(sourceNodeNumber);
+
+   if( it_s != graphNodes.end())
+   {
+      graphPoint *source = it_s->second;
+
+      // don't add an edge leading to any dest node that already has an edge back to the source (unidirectional graph).
+      // The source's incoming edges tell us that without looking up the dest
+      if(source->hasInEdge(destNodeNumber)) return;
+
+      bool isNewEdge = (source->getEdgeValue(destNodeNumber) == (-1));
+
+      source->createEdge(destNodeNumber, edgeWeight);
+      invalidateSnapshot();
+
+      // changing the weight of an edge doesn't make a new one
+      if(!isNewEdge) return;
+
+      m_totalNumEdges++;
+
+      std::map<int, graphPoint* >::iterator it_d = graphNodes.find(destNodeNumber);
+
+      if(it_d != graphNodes.end()) it_d->second->addInEdge(sourceNodeNumber);
+      else m_danglingInEdges[destNodeNumber].insert(sourceNodeNumber);
+   }
+}
+
+// this is O(log V + log degree), not O(1): finding either node is already a lookup in the graphNodes map,
+// and the edge itself is one more in the source's m_edges.  Both are kept ordered because GraphSnapshot
+// relies on walking them in order
 bool Graph::hasEdge(unsigned int sourceNodeNumber, unsigned int destNodeNumber)
 {
-   return (graphNodes.find(sourceNodeNumber)->second->getEdgeValue(sourceNodeNumber) == destNodeNumber);
+   std::map<int, graphPoint* >::iterator it = graphNodes.find(sourceNodeNumber);
+
+   return ((it != graphNodes.end()) && (it->second->getEdgeValue(destNodeNumber) != (-1)));
+}
+
+// returns NULL if the node doesn't exist
+const NodeNumberSet *Graph::getInEdges(unsigned int nodeNumber)
+{
+   std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+
+   return (it != graphNodes.end()) ? &it->second->m_inEdges : NULL;
+}
+
+
+void Graph::deleteEdge(unsigned int sourceNodeNumber,unsigned int destNodeNumber)
+{
+   std::map<int, graphPoint* >::iterator it = graphNodes.find(sourceNodeNumber);
+
+   if( it != graphNodes.end())
+   {
+      if(it->second->deleteEdge(destNodeNumber)) return;
+
+      m_totalNumEdges--;
+      invalidateSnapshot();
+
+      std::map<int, graphPoint* >::iterator it_d = graphNodes.find(destNodeNumber);
+
+      if(it_d != graphNodes.end())
+      {
+         it_d->second->removeInEdge(sourceNodeNumber);
+      }
+      else
+      {
+         NodeNumberSet &sources = m_danglingInEdges[destNodeNumber];
+
+         sources.erase(sourceNodeNumber);
+
+         if(sources.empty()) m_danglingInEdges.erase(destNodeNumber);
+      }
+   }
+}
+
+   
+//  make the specified node the origin
+void Graph::makeOriginNode(unsigned int nodeNumber)
+{
+   std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+
+   // To be complete, we should check if m_originNode is -1 before we set the origin.
+   // If m_originNode != -1, then the user had already set the origin, and is modifying it.
+   // In that case, we should remove "orgin-ness" from the originally set origin point
+   // For now, assume that the origin will not be changed once it's set.
+
+   if( it != graphNodes.end())
+   {
+      it->second->modifyPoint (0, true);
+      m_originNode = nodeNumber;
+   }
+}
+
+void Graph::setNodeValue(unsigned int nodeNumber, unsigned int cost)
+{
+   std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+
+   if( it != graphNodes.end())
+   {
+      it->second->setPointCost (cost);
+   }
+}
+
+// unsigned int Graph::getNodeValue(unsigned int nodeNumber)
+// {
+//    unsigned int retval = -1;
+//    std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+
+//    if( it != graphNodes.end())
+//    {
+//       retval = it->second->getPointCost ();
+//    }
+
+//    return retval;
+// }
+
+// change the weight of an existing edge
+//
+// return -1 if there's no such edge, 0 if ok.
+//
+int Graph::setEdgeValue(unsigned int sourceNodeNumber,unsigned int destNodeNumber, unsigned int weight )
+{
+   int retval = -1;
+   std::map<int, graphPoint* >::iterator it = graphNodes.find(sourceNodeNumber);
+
+   if( it != graphNodes.end())
+   {
+      retval = it->second->modifyEdge (destNodeNumber, weight);
+      invalidateSnapshot();
+   }
+
+   return retval;
+}
+
+
+//returns -1 if not found
+int Graph::getEdgeValue(unsigned int sourceNodeNumber,unsigned int destNodeNumber)
+{
+   unsigned int retval = -1;
+   std::map<int, graphPoint* >::iterator it = graphNodes.find(sourceNodeNumber);
+
+   if( it != graphNodes.end())
+   {
+      retval = it->second->getEdgeValue (destNodeNumber);
+   }
+
+   return retval;
+}
+
+// bool Graph::isNodeVisited(unsigned int nodeNumber)
+// {
+
+//    bool retval = false;
+//    std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+
+//    if( it != graphNodes.end())
+//    {
+//       retval = it->second->getVisited();
+//    }
+
+//    return retval;
+
+// }
+
+// void Graph::setNodeVisited(unsigned int nodeNumber)
+// {
+//    std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+
+//    if( it != graphNodes.end())
+//    {
+//       it->second->setVisited();
+//    }
+
+// }
+
+
+unsigned int Graph::getNodeCount()
+{
+   return m_totalNumVerticies;
+}
+
+unsigned int Graph::getEdgeCount()
+{
+   return m_totalNumEdges;
+}
+
+void Graph::printGraph()
+{
+   unsigned int retval = -1;
+   
+
+   for(std::map<int, graphPoint* >::iterator it = graphNodes.begin(); it != graphNodes.end(); ++it)
+   {
+      it->second->printGraphPoint();
+   }
+
+   std::cout << "TOTAL NODES: " << getNodeCount() << "\tTOTAL EDGES: " << getEdgeCount() << "\n" << std::endl;
+ 
+
+}
+
+
+
+void Graph::doDijkstra( unsigned int originNode, unsigned int destNode, std::list<unsigned int> *pathList, int &pathCost)
+{
+   bool validRouteFoundToDestination = false;
+   unsigned int closedNodeNum = originNode;
+
+   // std::cout << "---Running shortest path algorithm from node "<<originNode << " to node " << destNode << std::endl;
+
+   // initialize the outcome
+   pathCost = 0;
+   pathList->clear();
+
+   // special case for origin == destination, just return
+   if(originNode == destNode)
+   {
+      return;
+   }
+
+   // don't bother searching if there's no route at all.  Only asked if the snapshot is up to date, since
+   // building it is O(V+E) and a graph that's changed since the last query would pay that every time
+   if((m_snapshot != NULL) && !m_snapshot->canReach(originNode, destNode, *m_reachWork))
+   {
+      pathCost = -1;
+      return;
+   }
+
+   // before starting, clean the nodes of computed values in case we're re-running the algorythm
+   for(std::map<int, graphPoint* >::iterator itGraphNode = graphNodes.begin(); itGraphNode != graphNodes.end(); ++itGraphNode)
+   {
+      itGraphNode->second->cleanNode();
+   }
+
+   //
+   // run the shortest path algorithm on the graph passed in
+   //
+   makeOriginNode(originNode);
+
+   std::vector<unsigned int> openSet;    // a set of all "not yet visited" Nodes
+
+
+   while(true)
+   {
+      int numNodesAddedToOpenSet = 0;
+         
+      // std::cout << "New closed node: " << closedNodeNum << std::endl;
+      //
+      // add the connected nodes from this node to the open set (Step N+1)
+      //
+      std::map<int, graphPoint* >::iterator itGraphNode = graphNodes.find(closedNodeNum);
+
+      unsigned int closedNodeCost = itGraphNode->second->m_totalCost;
+
+      // std::cout << "The closed node cost is "<< closedNodeCost << std::endl;
+
+      // get all the nodes connected to this one and 
+      // adjust the costs and (from node) values of each connected node
+      // itGraphEdge->first is the connected node number and itGraphEdge->second is the edge cost
+      for(std::map<unsigned int, unsigned int>::iterator itGraphEdge= itGraphNode->second->m_edges.begin(); 
+          itGraphEdge != itGraphNode->second->m_edges.end(); 
+          ++itGraphEdge)
+      {
+
+         // first, mark this node as visited
+         itGraphNode->second->setVisited();
+
+         //         std::cout << "Examining node " << itGraphEdge->first << std::endl;
+
+         std::map<int, graphPoint* >::iterator itNextEdgeNode = graphNodes.find(itGraphEdge->first);
+
+         if(itNextEdgeNode == graphNodes.end()) continue;  // no node actually exists 
+
+         int i;
+         for(i=0; i<openSet.size(); i++)
+         {
+            if(openSet[i] == itNextEdgeNode->second->m_nodeNumber) break;
+         }
+
+          // add it to the open set if it's not there already and it hasn't already been visited
+         if(i == openSet.size() && (itNextEdgeNode->second->getVisited() == false))
+         {
+            openSet.push_back(itNextEdgeNode->second->m_nodeNumber);
+            numNodesAddedToOpenSet++;
+          }
+
+          // now see if this is a lower cost path to this connected node
+          if(itNextEdgeNode->second->getPointCost() == (-1) || 
+             (closedNodeCost + itGraphEdge->second) <  itNextEdgeNode->second->getPointCost())
+          {
+
+              // new lower cost found
+             itNextEdgeNode->second->setPointCost(static_cast<int>(closedNodeCost + itGraphEdge->second));
+             itNextEdgeNode->second->m_viaNode = closedNodeNum;
+
+
+             // std::cout << "found new lower cost (" << itNextEdgeNode->second->getPointCost() 
+             //           << ") to node " << itGraphEdge->first << " from node " 
+             //           << closedNodeNum << std::endl;
+
+          } 
+       }
+
+       // std::cout << "Openset now has " << openSet.size() << " members " << std::endl;
+
+       //if we didn't add any new members to the openset and it's empty, we are done
+       if ( (openSet.size() == 0) &&  (numNodesAddedToOpenSet == 0) )
+       {
+          //          std::cout << "openset is empty" << std::endl;
+          break;
+       }
+
+       // Now, find the lowest cost member of the open set and make it the new closed set member
+
+       unsigned int lowest_cost_node;
+       unsigned int lowest_cost_index;
+
+       for (int i=0; i<openSet.size(); i++)
+       {
+          int lowest_cost_val;
+
+          std::map<int, graphPoint* >::iterator itGraphNode = graphNodes.find(openSet[i]);
+
+          // std::cout << "i: " << i << " openset[i]: " << openSet[i] <<" nodenum: " <<  
+          //    itGraphNode->second->m_nodeNumber << " cost: " << itGraphNode->second->m_totalCost
+          //           << std::endl;
+
+          if((i==0) || (itGraphNode->second->m_totalCost < lowest_cost_val ))
+          {
+
+             lowest_cost_node = itGraphNode->second->m_nodeNumber;
+             lowest_cost_val = itGraphNode->second->m_totalCost;
+             lowest_cost_index = i;
+             // std::cout << "found new lowest cost node : " << lowest_cost_node << std::endl;
+          }
+       }
+
+
+       // this is the node that we'll be evaluating in the next iteration
+       closedNodeNum = lowest_cost_node;
+
+       // remove that node from the open set
+       // std::cout << "deleting node: " << lowest_cost_node << std::endl;
+
+       for(std::vector<unsigned int>::iterator vit = openSet.begin(); vit != openSet.end(); ++vit)
+       {
+
+          // std::cout << "lowest_cost_node is: " << lowest_cost_node << " and found openSet member number " << *vit << std::endl;
+
+          if (*vit == lowest_cost_node)
+          {
+             // std::cout << "erasing member!" << std::endl;
+             openSet.erase(vit);
+             break;
+          }
+       }
+
+       // std::cout << "Post delete: Openset now has " << openSet.size() << " members " << std::endl;
+
+
+       //if that node is the dest node, we have succeeded and we are done
+       if (closedNodeNum == destNode)
+       {
+          validRouteFoundToDestination = true;
+          // std::cout << "***Found a route to the destination node!" << std::endl;
+
+
+          break;
+       }
+
+       //else keep on truckin'
+    }
+
+   //
+   // Now tell the user whether or not we've been able to find a route
+   //   If so, print out the route
+   //   else, well..there's not much we can do except break the bad news
+   //
+    if(validRouteFoundToDestination == true)
+    {
+       std::vector<unsigned int> routeSet;
+
+       // now print out the route
+
+       unsigned int routeNode = destNode;
+       unsigned int lastRouteNode = routeNode;
+
+       // reuse the openSet vector to record the final route
+       pathCost = 0;
+
+       while(true)
+       {
+          pathList->push_front(routeNode);
+
+          // if we've added the orig to the route record, then we're done
+          if(routeNode == originNode) break;
+
+          //         std::cout << "route reclaimation looking for node " << routeNode << std::endl;
+          //         std::cout << "route reclaimation found node " << 
+          //            graphNodes.find(routeNode)->second->m_nodeNumber << std::endl;
+
+          // remember the "from" node for the cost computation
+          lastRouteNode = routeNode;
+
+          // find the "next" node
+          routeNode = graphNodes.find(routeNode)->second->m_viaNode;
+
+          //         std::cout << "route reclaimation found viaNode..." << routeNode << std::endl;
+
+          // record this hop in the total cost of the path
+
+          // std::cout << "Cost of route from " << routeNode << " to " << lastRouteNode << 
+          //    " is " << getEdgeValue(routeNode, lastRouteNode) << std::endl;
+
+          pathCost += getEdgeValue(routeNode, lastRouteNode);
+
+          
+       }
+    }
+    else
+    {
+       // std::cout << "Count not find a route from " << originNode << " to " << destNode << std::endl;
+       pathList->clear();  // no elements in the list
+       pathCost = -1;
+    }
+
+ }
+
+//*****************************************************************
+//**
+//** GraphBuilder methods
+//**
+//*****************************************************************
+//
+
+// run "work(threadNum)" for threadNum = 0..numThreads-1, each on its own thread, and wait for all of them
+template <typename Work>
+static void runOnThreads(unsigned int numThreads, Work work)
+{
+   std::vector<std::thread> threads;
+
+   for(unsigned int threadNum=1; threadNum<numThreads; threadNum++)
+   {
+      threads.push_back(std::thread(work, threadNum));
+   }
+
+   // the calling thread does its share too
+   work(0);
+
+   for(unsigned int i=0; i<threads.size(); i++)
+   {
+      threads[i].join();
+   }
+}
+
+const unsigned int GraphBuilder::RADIX_BITS;
+
+// numThreads of 0 means "use all the cores"
+GraphBuilder::GraphBuilder(unsigned int numThreads = 0)
+{
+   m_numThreads = numThreads ? numThreads : std::thread::hardware_concurrency();
+
+   if(m_numThreads == 0) m_numThreads = 1;
+}
+
+void GraphBuilder::reserve(unsigned int numNodes, unsigned int numEdges)
+{
+   m_nodes.reserve(numNodes);
+   m_edges.reserve(numEdges);
+}
+
+void GraphBuilder::addNode(unsigned int nodeNumber)
+{
+   m_nodes.push_back(nodeNumber);
+}
+
+void GraphBuilder::addEdge(unsigned int sourceNodeNumber, unsigned int destNodeNumber, unsigned int edgeWeight)
+{
+   edgeRecord edge;
+
+   edge.m_key = (static_cast<unsigned long long>(sourceNodeNumber) << 32) | destNodeNumber;
+   edge.m_seq = m_edges.size();
+   edge.m_weight = edgeWeight;
+
+   m_edges.push_back(edge);
+}
+
+void GraphBuilder::clear()
+{
+   m_nodes.clear();
+   m_edges.clear();
+}
+
+// LSD radix sort of edge records by key, up to RADIX_BITS bits per pass.  The digits are only put over the
+// bits of the key that vary, so with node numbers under a million (20 bits each side) it takes 4 passes.
+// Each thread histograms and scatters its own slice, and the slices are laid out in thread order,
+// so the sort is stable: equal keys stay in the order they were added.
+void GraphBuilder::radixSort(std::vector<edgeRecord> &records)
+{
+   size_t numEdges = records.size();
+   unsigned int numThreads = (numEdges < 65536) ? 1 : m_numThreads;
+
+   std::vector<edgeRecord> scratch(numEdges);
+   std::vector<edgeRecord> *from = &records;
+   std::vector<edgeRecord> *to = &scratch;
+
+   // find out which bits of the key actually vary, so that we can skip the passes that would do nothing
+   // (with small node numbers, most of the high bits are all zero)
+   std::vector<unsigned long long> orBits(numThreads, 0), andBits(numThreads, ~0ULL);
+
+   runOnThreads(numThreads, [&](unsigned int t)
+   {
+      for(size_t i = numEdges*t/numThreads; i < numEdges*(t+1)/numThreads; i++)
+      {
+         orBits[t] |= records[i].m_key;
+         andBits[t] &= records[i].m_key;
+      }
+   });
+
+   unsigned long long allOrBits = 0, allAndBits = ~0ULL;
+
+   for(unsigned int t=0; t<numThreads; t++)
+   {
+      allOrBits |= orBits[t];
+      allAndBits &= andBits[t];
+   }
+
+   unsigned long long varyingBits = allOrBits ^ allAndBits;
+
+   const unsigned int numDigits = 1 << RADIX_BITS;
+   std::vector<size_t> offsets(numThreads * numDigits);
+
+   for(unsigned int shift=0; shift<64; )
+   {
+      // start the next digit at the next bit that varies
+      if(((varyingBits >> shift) & 1) == 0)
+      {
+         shift++;
+         continue;
+      }
+
+      unsigned long long digitMask = (1ULL << std::min(RADIX_BITS, 64 - shift)) - 1;
+
+      std::fill(offsets.begin(), offsets.end(), 0);
+
+      // count how many of each digit every thread has
+      runOnThreads(numThreads, [&](unsigned int t)
+      {
+         size_t *count = &offsets[t*numDigits];
+
+         for(size_t i = numEdges*t/numThreads; i < numEdges*(t+1)/numThreads; i++)
+         {
+            count[((*from)[i].m_key >> shift) & digitMask]++;
+         }
+      });
+
+      // turn the counts into starting positions, digit major and thread minor
+      size_t position = 0;
+
+      for(unsigned int digit=0; digit<numDigits; digit++)
+      {
+         for(unsigned int t=0; t<numThreads; t++)
+         {
+            size_t count = offsets[t*numDigits + digit];
+            offsets[t*numDigits + digit] = position;
+            position += count;
+         }
+      }
+
+      // and move every edge to its place
+      runOnThreads(numThreads, [&](unsigned int t)
+      {
+         size_t *next = &offsets[t*numDigits];
+
+         for(size_t i = numEdges*t/numThreads; i < numEdges*(t+1)/numThreads; i++)
+         {
+            (*to)[next[((*from)[i].m_key >> shift) & digitMask]++] = (*from)[i];
+         }
+      });
+
+      std::swap(from, to);
+      shift += RADIX_BITS;
+   }
+
+   if(from != &records) records.swap(scratch);
+}
+
+// sort the edges, then collapse the duplicates.  The last weight given wins (as in createEdge()), but the
+// edge keeps the position of its first appearance, since that's when addEdge() would have put it in the
+// graph.  Returns how many edges are left
+size_t GraphBuilder::collapseDuplicates()
+{
+   radixSort(m_edges);
+
+   size_t numUnique = 0;
+
+   for(size_t first=0; first<m_edges.size(); )
+   {
+      size_t last = first;
+
+      while((last+1 < m_edges.size()) && (m_edges[last+1].m_key == m_edges[first].m_key)) last++;
+
+      unsigned int firstSeq = m_edges[first].m_seq;
+      unsigned int firstWeight = m_edges[first].m_weight;
+
+      m_edges[numUnique] = m_edges[last];
+      m_edges[numUnique].m_seq = firstSeq;
+
+      // an edge to self is its own reverse edge, so addEdge() never lets it be updated
+      if((m_edges[numUnique].m_key >> 32) == (m_edges[numUnique].m_key & 0xffffffff))
+      {
+         m_edges[numUnique].m_weight = firstWeight;
+      }
+
+      numUnique++;
+      first = last+1;
+   }
+
+   m_edges.resize(numUnique);
+
+   return numUnique;
+}
+
+// the "no edge if the reverse edge exists" pass over the numUnique collapsed edges.  The edges going up
+// (source < dest) are already sorted, so only the ones going down need sorting, turned around, to bring
+// each next to its reverse edge (if there is one)
+template <typename NodeExists>
+void GraphBuilder::dropReverseEdges(size_t numUnique, NodeExists nodeExists, std::vector<char> &keepEdge)
+{
+   std::vector<edgeRecord> downEdges;
+
+   for(size_t i=0; i<numUnique; i++)
+   {
+      unsigned long long sourceNodeNumber = m_edges[i].m_key >> 32;
+      unsigned long long destNodeNumber = m_edges[i].m_key & 0xffffffff;
+
+      if(sourceNodeNumber <= destNodeNumber) continue;
+
+      edgeRecord downEdge;
+
+      downEdge.m_key = (destNodeNumber << 32) | sourceNodeNumber;
+      downEdge.m_seq = m_edges[i].m_seq;
+      downEdge.m_weight = i;   // where the edge is in m_edges
+      downEdges.push_back(downEdge);
+   }
+
+   radixSort(downEdges);
+
+   // then walk the up edges and the down edges together
+   size_t up = 0;
+
+   for(size_t down=0; down<downEdges.size(); down++)
+   {
+      while((up < numUnique) && (((m_edges[up].m_key >> 32) >= (m_edges[up].m_key & 0xffffffff)) || (m_edges[up].m_key < downEdges[down].m_key)))
+      {
+         up++;
+      }
+
+      if((up == numUnique) || (m_edges[up].m_key != downEdges[down].m_key)) continue;
+
+      // whichever direction came first wins.  The loser is dropped as long as the winner made it in,
+      // i.e. as long as the winner's source (the loser's dest) exists
+      size_t loser = (m_edges[up].m_seq < downEdges[down].m_seq) ? downEdges[down].m_weight : up;
+      unsigned int loserDestNodeNumber = m_edges[loser].m_key & 0xffffffff;
+
+      if(nodeExists(loserDestNodeNumber)) keepEdge[loser] = 0;
+   }
+}
+
+// split the first numEdges (sorted) edges into numThreads runs, startEdge[t] .. startEdge[t+1]-1, so that
+// no node's edges (by the top half of the key) are split between two threads
+void GraphBuilder::splitByNode(size_t numEdges, unsigned int numThreads, std::vector<size_t> &startEdge)
+{
+   startEdge.assign(numThreads+1, numEdges);
+
+   for(unsigned int t=0; t<numThreads; t++)
+   {
+      size_t i = numEdges*t/numThreads;
+
+      while((i > 0) && (i < numEdges) && ((m_edges[i].m_key >> 32) == (m_edges[i-1].m_key >> 32))) i++;
+
+      startEdge[t] = i;
+   }
+}
+
+// put all the collected nodes and edges into G, and empty the builder.
+//
+// All the nodes go in before any of the edges, so an edge given here before its source node is kept
+// (where G.addEdge() then G.addNode() would have dropped it).  Otherwise the outcome is the same as calling
+// G.addEdge() for each edge in the order they were given here:
+//  - edges from a node that is neither in G nor given here are dropped
+//  - a repeated edge keeps the last weight given
+//  - an edge is dropped if the reverse edge was already in the graph, or was given here first
+//
+unsigned int GraphBuilder::build(Graph &G)
+{
+   bool graphHadEdges = (G.m_totalNumEdges != 0);
+
+   //
+   // add the nodes first, in order, so that each map insert goes at the end of the map
+   //
+   std::sort(m_nodes.begin(), m_nodes.end());
+
+   for(size_t i=0; i<m_nodes.size(); i++)
+   {
+      if(i && (m_nodes[i] == m_nodes[i-1])) continue;
+
+      std::map<int, graphPoint* >::iterator it =
+         G.graphNodes.insert(G.graphNodes.end(), std::pair<int, graphPoint*>(m_nodes[i], NULL));
+
+      // a node that's already in the graph keeps its edges
+      if(it->second == NULL)
+      {
+         it->second = new graphPoint(m_nodes[i]);
+         G.m_totalNumVerticies++;
+         G.m_originNode = -1;
+         G.adoptDanglingInEdges(it->second);
+      }
+   }
+
+   size_t numUnique = collapseDuplicates();
+
+   unsigned int numThreads = (numUnique < 65536) ? 1 : m_numThreads;
+
+   std::vector<char> keepEdge(numUnique, 1);
+
+   dropReverseEdges(numUnique, [&G](unsigned int nodeNumber) { return G.graphNodes.find(nodeNumber) != G.graphNodes.end(); }, keepEdge);
+
+   // edges already in the graph came before all of these
+   if(graphHadEdges)
+   {
+      runOnThreads(numThreads, [&](unsigned int t)
+      {
+         for(size_t i = numUnique*t/numThreads; i < numUnique*(t+1)/numThreads; i++)
+         {
+            unsigned int sourceNodeNumber = m_edges[i].m_key >> 32;
+            unsigned int destNodeNumber = m_edges[i].m_key & 0xffffffff;
+
+            std::map<int, graphPoint* >::iterator it_s = G.graphNodes.find(sourceNodeNumber);
+            std::map<int, graphPoint* >::iterator it_d = G.graphNodes.find(destNodeNumber);
+
+            // the reverse edge is already in the graph
+            if((it_d != G.graphNodes.end()) && (it_d->second->getEdgeValue(sourceNodeNumber) != (-1)))
+            {
+               keepEdge[i] = 0;
+            }
+
+            // this edge is already in the graph, so it wins against its reverse edge whatever the order
+            else if((it_s != G.graphNodes.end()) && (it_s->second->getEdgeValue(destNodeNumber) != (-1)))
+            {
+               keepEdge[i] = 1;
+            }
+         }
+      });
+   }
+
+   //
+   // now emit the edges.  Each thread takes whole source nodes, so no two threads ever touch the same
+   // graphPoint, and the edges of a node arrive in order so each map insert goes at the end of the map
+   //
+   std::vector<size_t> startEdge;
+
+   splitByNode(numUnique, numThreads, startEdge);
+
+   std::vector< std::vector<edgeRecord> > newEdges(numThreads);   // the edges added (not just updated), by dest
+
+   runOnThreads(numThreads, [&](unsigned int t)
+   {
+      std::map<int, graphPoint* >::iterator it_s = G.graphNodes.end();
+
+      for(size_t i = startEdge[t]; i < startEdge[t+1]; i++)
+      {
+         unsigned int sourceNodeNumber = m_edges[i].m_key >> 32;
+         unsigned int destNodeNumber = m_edges[i].m_key & 0xffffffff;
+
+         if((i == startEdge[t]) || (sourceNodeNumber != (m_edges[i-1].m_key >> 32)))
+         {
+            it_s = G.graphNodes.find(sourceNodeNumber);
+         }
+
+         // there are no edges from a node that doesn't exist
+         if((it_s == G.graphNodes.end()) || !keepEdge[i]) continue;
+
+         graphPoint *source = it_s->second;
+         size_t numEdgesBefore = source->m_edges.size();
+
+         std::map<unsigned int, unsigned int>::iterator itEdge =
+            source->m_edges.insert(source->m_edges.end(),
+                                   std::pair<unsigned int,unsigned int>(destNodeNumber, m_edges[i].m_weight));
+
+         if(source->m_edges.size() != numEdgesBefore)
+         {
+            edgeRecord newEdge;
+
+            newEdge.m_key = (static_cast<unsigned long long>(destNodeNumber) << 32) | sourceNodeNumber;
+            newEdge.m_seq = 0;
+            newEdge.m_weight = 0;
+            newEdges[t].push_back(newEdge);
+
+            source->m_numEdges++;
+         }
+         else
+         {
+            itEdge->second = m_edges[i].m_weight;
+         }
+      }
+   });
+
+   //
+   // now the dest side of the new edges.  Sorted by dest, each thread can take whole dest nodes, and each
+   // node's set of sources only has to grow once
+   //
+   m_edges.clear();
+
+   for(unsigned int t=0; t<numThreads; t++)
+   {
+      m_edges.insert(m_edges.end(), newEdges[t].begin(), newEdges[t].end());
+      std::vector<edgeRecord>().swap(newEdges[t]);
+   }
+
+   unsigned int totalEdgesAdded = m_edges.size();
+
+   radixSort(m_edges);
+   splitByNode(totalEdgesAdded, numThreads, startEdge);
+
+   std::vector< std::vector<edgeRecord> > danglingEdges(numThreads);   // edges to nodes that don't exist
+
+   runOnThreads(numThreads, [&](unsigned int t)
+   {
+      for(size_t first = startEdge[t]; first < startEdge[t+1]; )
+      {
+         unsigned int destNodeNumber = m_edges[first].m_key >> 32;
+         size_t last = first;
+
+         while((last < startEdge[t+1]) && ((m_edges[last].m_key >> 32) == destNodeNumber)) last++;
+
+         std::map<int, graphPoint* >::iterator it_d = G.graphNodes.find(destNodeNumber);
+
+         if(it_d == G.graphNodes.end())
+         {
+            danglingEdges[t].insert(danglingEdges[t].end(), m_edges.begin() + first, m_edges.begin() + last);
+         }
+         else
+         {
+            NodeNumberSet &inEdges = it_d->second->m_inEdges;
+
+            inEdges.reserve(inEdges.size() + (last - first));
+
+            for(size_t i=first; i<last; i++)
+            {
+               inEdges.insert(m_edges[i].m_key & 0xffffffff);
+            }
+         }
+
+         first = last;
+      }
+   });
+
+   for(unsigned int t=0; t<numThreads; t++)
+   {
+      for(unsigned int i=0; i<danglingEdges[t].size(); i++)
+      {
+         G.m_danglingInEdges[danglingEdges[t][i].m_key >> 32].insert(danglingEdges[t][i].m_key & 0xffffffff);
+      }
+   }
+
+   G.m_totalNumEdges += totalEdgesAdded;
+   G.invalidateSnapshot();
+
+   clear();
+
+   return totalEdgesAdded;
+}
+
+// make a snapshot of just the collected nodes and edges, and empty the builder.  It's the snapshot that
+// build() into an empty Graph and then getSnapshot() would give, but the sorted edges are already in the
+// order the snapshot keeps them, so they go straight into its arrays without a map per node in between
+GraphSnapshot *GraphBuilder::buildSnapshot(unsigned int version = 0)
+{
+   GraphSnapshot *snapshot = new GraphSnapshot(version);
+   GraphSnapshot::snapshotTopology &topology = *snapshot->m_topology;
+
+   std::sort(m_nodes.begin(), m_nodes.end());
+   m_nodes.erase(std::unique(m_nodes.begin(), m_nodes.end()), m_nodes.end());
+
+   topology.m_nodeNumbers.assign(m_nodes.begin(), m_nodes.end());
+
+   unsigned int numNodes = m_nodes.size();
+
+   // node number to index.  A straight table when the node numbers are dense enough, since there's one
+   // lookup per edge, otherwise a binary search
+   std::vector<int> nodeIndex;
+
+   if(numNodes && (m_nodes.back() < 4ULL * numNodes + 1024))
+   {
+      nodeIndex.assign(m_nodes.back() + 1ULL, -1);
+
+      for(unsigned int index=0; index<numNodes; index++)
+      {
+         nodeIndex[m_nodes[index]] = index;
+      }
+   }
+
+   auto findIndex = [&](unsigned int nodeNumber) -> int
+   {
+      if(nodeIndex.empty()) return snapshot->findNode(nodeNumber);
+
+      return (nodeNumber < nodeIndex.size()) ? nodeIndex[nodeNumber] : (-1);
+   };
+
+   size_t numUnique = collapseDuplicates();
+   std::vector<char> keepEdge(numUnique, 1);
+
+   dropReverseEdges(numUnique, [&findIndex](unsigned int nodeNumber) { return findIndex(nodeNumber) != (-1); }, keepEdge);
+
+   //
+   // the edges are sorted by (source, dest), which is the order the snapshot wants them in.  Each thread
+   // takes whole source nodes, works out the dest index of each edge it keeps (m_seq isn't needed any
+   // more, so it goes there) and counts them, then copies them into its place
+   //
+   unsigned int numThreads = (numUnique < 65536) ? 1 : m_numThreads;
+   std::vector<size_t> startEdge;
+   std::vector<size_t> numKept(numThreads+1, 0);
+
+   splitByNode(numUnique, numThreads, startEdge);
+
+   topology.m_edgeStart.assign(numNodes + 1, 0);
+
+   runOnThreads(numThreads, [&](unsigned int t)
+   {
+      int sourceIndex = (-1);
+
+      for(size_t i = startEdge[t]; i < startEdge[t+1]; i++)
+      {
+         if((i == startEdge[t]) || ((m_edges[i].m_key >> 32) != (m_edges[i-1].m_key >> 32)))
+         {
+            sourceIndex = findIndex(m_edges[i].m_key >> 32);
+         }
+
+         int destIndex = findIndex(m_edges[i].m_key & 0xffffffff);
+
+         // there are no edges from (or, in a snapshot, to) a node that doesn't exist
+         if((sourceIndex == (-1)) || (destIndex == (-1)) || !keepEdge[i])
+         {
+            m_edges[i].m_seq = UINT_MAX;
+            continue;
+         }
+
+         m_edges[i].m_seq = destIndex;
+
+         // only this thread has edges from sourceIndex
+         topology.m_edgeStart[sourceIndex + 1]++;
+         numKept[t+1]++;
+      }
+   });
+
+   for(unsigned int t=0; t<numThreads; t++)
+   {
+      numKept[t+1] += numKept[t];
+   }
+
+   for(unsigned int index=0; index<numNodes; index++)
+   {
+      topology.m_edgeStart[index+1] += topology.m_edgeStart[index];
+   }
+
+   topology.m_edgeDest.resize(numKept[numThreads]);
+   snapshot->m_edgeWeight.resize(numKept[numThreads]);
+
+   runOnThreads(numThreads, [&](unsigned int t)
+   {
+      size_t edge = numKept[t];
+
+      for(size_t i = startEdge[t]; i < startEdge[t+1]; i++)
+      {
+         if(m_edges[i].m_seq == UINT_MAX) continue;
+
+         topology.m_edgeDest[edge] = m_edges[i].m_seq;
+         snapshot->m_edgeWeight[edge] = m_edges[i].m_weight;
+         edge++;
+      }
+   });
+
+   clear();
+
+   snapshot->buildReverseEdges();
+
+   return snapshot;
+}
+
+//*****************************************************************
+//**
+//** SearchWorkspace methods
+//**
+//*****************************************************************
+//
+
+SearchWorkspace::SearchWorkspace()
+{
+   m_stamp = 0;
+}
+
+// get ready for a new search of a graph with numNodes nodes.  Only grows the arrays the first time
+// (or when the graph gets bigger), otherwise it costs nothing
+void SearchWorkspace::startSearch(unsigned int numNodes)
+{
+   if(m_reachedStamp.size() < numNodes)
+   {
+      m_reachedStamp.resize(numNodes, 0);
+      m_settledStamp.resize(numNodes, 0);
+      m_blockedStamp.resize(numNodes, 0);
+      m_cost.resize(numNodes);
+      m_viaNode.resize(numNodes);
+   }
+
+   m_openSet.clear();
+
+   // when the stamp wraps around, old entries could look current, so clear them out for real
+   if(++m_stamp == 0)
+   {
+      std::fill(m_reachedStamp.begin(), m_reachedStamp.end(), 0);
+      std::fill(m_settledStamp.begin(), m_settledStamp.end(), 0);
+      std::fill(m_blockedStamp.begin(), m_blockedStamp.end(), 0);
+      m_stamp = 1;
+   }
+}
+
+bool SearchWorkspace::isReached(unsigned int index)
+{
+   return (m_reachedStamp[index] == m_stamp);
+}
+
+bool SearchWorkspace::isSettled(unsigned int index)
+{
+   return (m_settledStamp[index] == m_stamp);
+}
+
+bool SearchWorkspace::isBlocked(unsigned int index)
+{
+   return (m_blockedStamp[index] == m_stamp);
+}
+
+// returns the cost found to the node, or -1 if it hasn't been reached
+int SearchWorkspace::getCost(unsigned int index)
+{
+   return isReached(index) ? m_cost[index] : (-1);
+}
+
+// record a way to the node, and put it in the open set, if it's the first or the cheapest yet.
+// returns true if it was
+bool SearchWorkspace::reachNode(unsigned int index, int cost, unsigned int viaNode)
+{
+   if(isReached(index) && (cost >= m_cost[index])) return false;
+
+   m_reachedStamp[index] = m_stamp;
+   m_cost[index] = cost;
+   m_viaNode[index] = viaNode;
+
+   m_openSet.push_back(std::pair<int, unsigned int>(cost, index));
+   std::push_heap(m_openSet.begin(), m_openSet.end(), std::greater< std::pair<int, unsigned int> >());
+
+   return true;
+}
+
+
+//*****************************************************************
+//**
+//** BreadthFirstWorkspace methods
+//**
+//*****************************************************************
+//
+
+BreadthFirstWorkspace::BreadthFirstWorkspace()
+{
+   m_numNodes = 0;
+   m_stamp = 0;
+}
+
+void BreadthFirstWorkspace::startSearch(unsigned int numNodes, unsigned int numThreads)
+{
+   if(m_numNodes < numNodes)
+   {
+      m_reachedStamp.reset(new std::atomic<unsigned int>[numNodes]);
+      m_frontierBits.reset(new std::atomic<unsigned long long>[(numNodes + 63) / 64]);
+      m_parent.resize(numNodes);
+      m_numNodes = numNodes;
+
+      for(unsigned int i=0; i<numNodes; i++) m_reachedStamp[i] = 0;
+
+      m_stamp = 0;
+   }
+
+   m_nextFrontier.resize(numThreads);
+   m_frontier.clear();
+
+   // when the stamp wraps around, old entries could look current, so clear them out for real
+   if(++m_stamp == 0)
+   {
+      for(unsigned int i=0; i<m_numNodes; i++) m_reachedStamp[i] = 0;
+
+      m_stamp = 1;
+   }
+}
+
+
+//*****************************************************************
+//**
+//** ReachabilityIndex methods
+//**
+//*****************************************************************
+//
+
+// build the index for a graph given as flat arrays (as in GraphSnapshot)
+void ReachabilityIndex::build(const std::vector<unsigned int> &edgeStart, const std::vector<unsigned int> &edgeDest)
+{
+   const unsigned int UNVISITED = UINT_MAX;
+   unsigned int numNodes = edgeStart.size() - 1;
+   unsigned int numComponents = 0;
+   unsigned int numVisited = 0;
+
+   //
+   // Tarjan's algorithm, with our own stack of (node, next edge) rather than recursion, so that
+   // long paths can't overflow the real stack
+   //
+   std::vector<unsigned int> visitOrder(numNodes, UNVISITED);  // when each node was first reached
+   std::vector<unsigned int> lowLink(numNodes);                // the earliest node reachable from its subtree
+   std::vector<char> onStack(numNodes, 0);
+   std::vector<unsigned int> componentStack;                   // nodes not yet assigned a component
+   std::vector< std::pair<unsigned int, unsigned int> > callStack;
+
+   m_component.assign(numNodes, 0);
+   m_componentSize.clear();
+
+   for(unsigned int root=0; root<numNodes; root++)
+   {
+      if(visitOrder[root] != UNVISITED) continue;
+
+      visitOrder[root] = lowLink[root] = numVisited++;
+      componentStack.push_back(root);
+      onStack[root] = 1;
+      callStack.push_back(std::pair<unsigned int, unsigned int>(root, edgeStart[root]));
+
+      while(!callStack.empty())
+      {
+         unsigned int node = callStack.back().first;
+         unsigned int &nextEdge = callStack.back().second;
+
+         if(nextEdge < edgeStart[node+1])
+         {
+            unsigned int nextNode = edgeDest[nextEdge++];
+
+            if(visitOrder[nextNode] == UNVISITED)
+            {
+               visitOrder[nextNode] = lowLink[nextNode] = numVisited++;
+               componentStack.push_back(nextNode);
+               onStack[nextNode] = 1;
+               callStack.push_back(std::pair<unsigned int, unsigned int>(nextNode, edgeStart[nextNode]));
+            }
+            else if(onStack[nextNode])
+            {
+               lowLink[node] = std::min(lowLink[node], visitOrder[nextNode]);
+            }
+
+            continue;
+         }
+
+         // done with this node.  If nothing below it reaches further back, it heads a component
+         callStack.pop_back();
+
+         if(lowLink[node] == visitOrder[node])
+         {
+            unsigned int member;
+
+            m_componentSize.push_back(0);
+
+            do
+            {
+               member = componentStack.back();
+               componentStack.pop_back();
+               onStack[member] = 0;
+               m_component[member] = numComponents;
+               m_componentSize[numComponents]++;
+            } while(member != node);
+
+            numComponents++;
+         }
+
+         if(!callStack.empty())
+         {
+            unsigned int parent = callStack.back().first;
+            lowLink[parent] = std::min(lowLink[parent], lowLink[node]);
+         }
+      }
+   }
+
+   //
+   // collapse the components into a DAG, with no repeated edges
+   //
+   std::vector< std::pair<unsigned int, unsigned int> > dagEdges;
+
+   for(unsigned int node=0; node<numNodes; node++)
+   {
+      for(unsigned int edge = edgeStart[node]; edge < edgeStart[node+1]; edge++)
+      {
+         if(m_component[node] != m_component[edgeDest[edge]])
+         {
+            dagEdges.push_back(std::pair<unsigned int, unsigned int>(m_component[node], m_component[edgeDest[edge]]));
+         }
+      }
+   }
+
+   std::sort(dagEdges.begin(), dagEdges.end());
+   dagEdges.erase(std::unique(dagEdges.begin(), dagEdges.end()), dagEdges.end());
+
+   m_dagStart.assign(numComponents+1, 0);
+   m_dagDest.resize(dagEdges.size());
+
+   for(unsigned int i=0; i<dagEdges.size(); i++)
+   {
+      m_dagStart[dagEdges[i].first + 1]++;
+      m_dagDest[i] = dagEdges[i].second;
+   }
+
+   for(unsigned int component=0; component<numComponents; component++)
+   {
+      m_dagStart[component+1] += m_dagStart[component];
+   }
+
+   //
+   // label the DAG.  Each walk is a post-order DFS, and a component's interval runs from the lowest rank
+   // of anything below it to its own rank.  The walks go in opposite orders, so that they miss different
+   // things
+   //
+   m_labels.assign(numComponents * NUM_WALKS * 2, 0);
+
+   std::vector<char> visited;
+
+   for(unsigned int walk=0; walk<NUM_WALKS; walk++)
+   {
+      unsigned int rank = 0;
+      bool reversed = (walk % 2);
+
+      visited.assign(numComponents, 0);
+
+      for(unsigned int i=0; i<numComponents; i++)
+      {
+         unsigned int root = reversed ? (numComponents - 1 - i) : i;
+
+         if(visited[root]) continue;
+
+         visited[root] = 1;
+         callStack.clear();
+         callStack.push_back(std::pair<unsigned int, unsigned int>(root, 0));
+
+         while(!callStack.empty())
+         {
+            unsigned int component = callStack.back().first;
+            unsigned int &numChildrenDone = callStack.back().second;
+            unsigned int numChildren = m_dagStart[component+1] - m_dagStart[component];
+
+            if(numChildrenDone < numChildren)
+            {
+               unsigned int childEdge = reversed ? (m_dagStart[component+1] - 1 - numChildrenDone) : (m_dagStart[component] + numChildrenDone);
+               unsigned int child = m_dagDest[childEdge];
+
+               numChildrenDone++;
+
+               if(!visited[child])
+               {
+                  visited[child] = 1;
+                  callStack.push_back(std::pair<unsigned int, unsigned int>(child, 0));
+               }
+
+               continue;
+            }
+
+            // all the children are labelled, so this one can be
+            unsigned int lowestRank = rank;
+
+            for(unsigned int edge = m_dagStart[component]; edge < m_dagStart[component+1]; edge++)
+            {
+               lowestRank = std::min(lowestRank, m_labels[(m_dagDest[edge] * NUM_WALKS + walk) * 2]);
+            }
+
+            m_labels[(component * NUM_WALKS + walk) * 2] = lowestRank;
+            m_labels[(component * NUM_WALKS + walk) * 2 + 1] = rank++;
+
+            callStack.pop_back();
+         }
+      }
+   }
+}
+
+unsigned int ReachabilityIndex::getComponentCount() const
+{
+   return m_componentSize.size();
+}
+
+unsigned int ReachabilityIndex::getComponent(unsigned int index) const
+{
+   return m_component[index];
+}
+
+unsigned int ReachabilityIndex::getComponentSize(unsigned int component) const
+{
+   return m_componentSize[component];
+}
+
+// do all of inner's intervals sit inside outer's?  (they must, if outer can reach inner)
+bool ReachabilityIndex::labelsContain(unsigned int outer, unsigned int inner) const
+{
+   const unsigned int *outerLabels = &m_labels[outer * NUM_WALKS * 2];
+   const unsigned int *innerLabels = &m_labels[inner * NUM_WALKS * 2];
+
+   for(unsigned int walk=0; walk<NUM_WALKS; walk++)
+   {
+      if((innerLabels[walk*2] < outerLabels[walk*2]) || (innerLabels[walk*2+1] > outerLabels[walk*2+1])) return false;
+   }
+
+   return true;
+}
+
+// "work" is only needed for the (rare) DFS
+bool ReachabilityIndex::canReach(unsigned int originIndex, unsigned int destIndex, SearchWorkspace &work) const
+{
+   unsigned int originComponent = m_component[originIndex];
+   unsigned int destComponent = m_component[destIndex];
+
+   // every node in a component reaches every other one
+   if(originComponent == destComponent) return true;
+
+   // edges only go down in number, and the labels have to nest
+   if((originComponent < destComponent) || !labelsContain(originComponent, destComponent)) return false;
+
+   // the labels can't rule it out, so look for it, skipping any part of the DAG whose labels rule it out.
+   // The workspace's open set doubles as the DFS stack
+   work.startSearch(m_componentSize.size());
+
+   work.m_settledStamp[originComponent] = work.m_stamp;
+   work.m_openSet.push_back(std::pair<int, unsigned int>(0, originComponent));
+
+   while(!work.m_openSet.empty())
+   {
+      unsigned int component = work.m_openSet.back().second;
+
+      work.m_openSet.pop_back();
+
+      for(unsigned int edge = m_dagStart[component]; edge < m_dagStart[component+1]; edge++)
+      {
+         unsigned int child = m_dagDest[edge];
+
+         if(child == destComponent) return true;
+
+         if(work.isSettled(child) || (child < destComponent) || !labelsContain(child, destComponent)) continue;
+
+         work.m_settledStamp[child] = work.m_stamp;
+         work.m_openSet.push_back(std::pair<int, unsigned int>(0, child));
+      }
+   }
+
+   return false;
+}
+
+
+//*****************************************************************
+//**
+//** GraphSnapshot methods
+//**
+//*****************************************************************
+//
+
+GraphSnapshot::GraphSnapshot(Graph &G, unsigned int version = 0) :
+   m_topology(new snapshotTopology),
+   m_nodeNumbers(m_topology->m_nodeNumbers),
+   m_edgeStart(m_topology->m_edgeStart),
+   m_edgeDest(m_topology->m_edgeDest),
+   m_reverseStart(m_topology->m_reverseStart),
+   m_reverseDest(m_topology->m_reverseDest),
+   m_reach(m_topology->m_reach)
+{
+   snapshotTopology &topology = *m_topology;
+
+   m_version = version;
+
+   topology.m_nodeNumbers.reserve(G.graphNodes.size());
+   topology.m_edgeStart.reserve(G.graphNodes.size() + 1);
+
+   for(std::map<int, graphPoint* >::iterator itGraphNode = G.graphNodes.begin(); itGraphNode != G.graphNodes.end(); ++itGraphNode)
+   {
+      topology.m_nodeNumbers.push_back(itGraphNode->first);
+   }
+
+   // the map is in node order, so node i's edges can be laid down right after node i-1's
+   for(std::map<int, graphPoint* >::iterator itGraphNode = G.graphNodes.begin(); itGraphNode != G.graphNodes.end(); ++itGraphNode)
+   {
+      topology.m_edgeStart.push_back(m_edgeDest.size());
+
+      for(std::map<unsigned int, unsigned int>::iterator itGraphEdge = itGraphNode->second->m_edges.begin();
+          itGraphEdge != itGraphNode->second->m_edges.end();
+          ++itGraphEdge)
+      {
+         int destIndex = findNode(itGraphEdge->first);
+
+         if(destIndex == (-1)) continue;  // no node actually exists
+
+         topology.m_edgeDest.push_back(destIndex);
+         m_edgeWeight.push_back(itGraphEdge->second);
+      }
+   }
+
+   topology.m_edgeStart.push_back(m_edgeDest.size());
+
+   buildReverseEdges();
+}
+
+// an empty snapshot, for a GraphBuilder to fill in
+GraphSnapshot::GraphSnapshot(unsigned int version) :
+   m_topology(new snapshotTopology),
+   m_nodeNumbers(m_topology->m_nodeNumbers),
+   m_edgeStart(m_topology->m_edgeStart),
+   m_edgeDest(m_topology->m_edgeDest),
+   m_reverseStart(m_topology->m_reverseStart),
+   m_reverseDest(m_topology->m_reverseDest),
+   m_reach(m_topology->m_reach)
+{
+   m_version = version;
+}
+
+// fill in everything else once the nodes and the forward edges are in
+void GraphSnapshot::buildReverseEdges()
+{
+   snapshotTopology &topology = *m_topology;
+
+   // turn the edges around: count each node's incoming edges, then lay them down in order of source
+   topology.m_reverseStart.assign(m_nodeNumbers.size() + 1, 0);
+   topology.m_reverseDest.resize(m_edgeDest.size());
+   m_reverseWeight.resize(m_edgeDest.size());
+
+   for(unsigned int edge=0; edge<m_edgeDest.size(); edge++)
+   {
+      topology.m_reverseStart[m_edgeDest[edge] + 1]++;
+   }
+
+   for(unsigned int index=0; index<m_nodeNumbers.size(); index++)
+   {
+      topology.m_reverseStart[index+1] += m_reverseStart[index];
+   }
+
+   std::vector<unsigned int> nextReverseEdge(m_reverseStart.begin(), m_reverseStart.end() - 1);
+
+   for(unsigned int index=0; index<m_nodeNumbers.size(); index++)
+   {
+      for(unsigned int edge = m_edgeStart[index]; edge < m_edgeStart[index+1]; edge++)
+      {
+         unsigned int reverseEdge = nextReverseEdge[m_edgeDest[edge]]++;
+
+         topology.m_reverseDest[reverseEdge] = index;
+         m_reverseWeight[reverseEdge] = m_edgeWeight[edge];
+      }
+   }
+
+   topology.m_reach.build(m_edgeStart, m_edgeDest);
+}
+
+// a copy of previous, to be re-weighted with setEdgeValue().  Only the weights are copied; everything else
+// (including the reachability index, which weights don't affect) is shared
+GraphSnapshot::GraphSnapshot(const GraphSnapshot &previous, unsigned int version) :
+   m_topology(previous.m_topology),
+   m_nodeNumbers(m_topology->m_nodeNumbers),
+   m_edgeStart(m_topology->m_edgeStart),
+   m_edgeDest(m_topology->m_edgeDest),
+   m_edgeWeight(previous.m_edgeWeight),
+   m_reverseStart(m_topology->m_reverseStart),
+   m_reverseDest(m_topology->m_reverseDest),
+   m_reverseWeight(previous.m_reverseWeight),
+   m_reach(m_topology->m_reach)
+{
+   m_version = version;
+}
+
+// change the weight of an edge that's already there (does nothing if it isn't).  Only for a snapshot that
+// no reader has seen yet
+void GraphSnapshot::setEdgeValue(unsigned int sourceNodeNumber, unsigned int destNodeNumber, unsigned int weight)
+{
+   int sourceIndex = findNode(sourceNodeNumber);
+   int destIndex = findNode(destNodeNumber);
+
+   if((sourceIndex == (-1)) || (destIndex == (-1))) return;
+
+   for(unsigned int edge = m_edgeStart[sourceIndex]; edge < m_edgeStart[sourceIndex+1]; edge++)
+   {
+      if(m_edgeDest[edge] == static_cast<unsigned int>(destIndex)) m_edgeWeight[edge] = weight;
+   }
+
+   for(unsigned int edge = m_reverseStart[destIndex]; edge < m_reverseStart[destIndex+1]; edge++)
+   {
+      if(m_reverseDest[edge] == static_cast<unsigned int>(sourceIndex)) m_reverseWeight[edge] = weight;
+   }
+}
+
+unsigned int GraphSnapshot::getNodeCount() const
+{
+   return m_nodeNumbers.size();
+}
+
+unsigned int GraphSnapshot::getEdgeCount() const
+{
+   return m_edgeDest.size();
+}
+
+unsigned int GraphSnapshot::getVersion() const
+{
+   return m_version;
+}
+
+// the position of nodeNumber in the sorted nodeNumbers, or -1 if it isn't there
+static int findNodeIndex(const std::vector<int> &nodeNumbers, unsigned int nodeNumber)
+{
+   std::vector<int>::const_iterator it = std::lower_bound(nodeNumbers.begin(), nodeNumbers.end(), static_cast<int>(nodeNumber));
+
+   if((it == nodeNumbers.end()) || (*it != static_cast<int>(nodeNumber))) return (-1);
+
+   return (it - nodeNumbers.begin());
+}
+
+// returns -1 if not found
+int GraphSnapshot::findNode(unsigned int nodeNumber) const
+{
+   return findNodeIndex(m_nodeNumbers, nodeNumber);
+}
+
+unsigned int GraphSnapshot::getNodeNumber(unsigned int index) const
+{
+   return m_nodeNumbers[index];
+}
+
+unsigned int GraphSnapshot::getOutDegree(unsigned int index) const
+{
+   return m_edgeStart[index+1] - m_edgeStart[index];
+}
+
+unsigned int GraphSnapshot::getInDegree(unsigned int index) const
+{
+   return m_reverseStart[index+1] - m_reverseStart[index];
+}
+
+const ReachabilityIndex &GraphSnapshot::getReachability() const
+{
+   return m_reach;
+}
+
+// is there any route at all from originNode to destNode?  (false if either node doesn't exist)
+bool GraphSnapshot::canReach(unsigned int originNode, unsigned int destNode, SearchWorkspace &work) const
+{
+   int originIndex = findNode(originNode);
+   int destIndex = findNode(destNode);
+
+   if((originIndex == (-1)) || (destIndex == (-1))) return false;
+
+   return m_reach.canReach(originIndex, destIndex, work);
+}
+
+// start a search from originIndex, with the origin in the open set at a cost of 0
+void GraphSnapshot::beginSearch(unsigned int originIndex, SearchWorkspace &work) const
+{
+   work.startSearch(m_nodeNumbers.size());
+
+   work.m_reachedStamp[originIndex] = work.m_stamp;
+   work.m_cost[originIndex] = 0;
+   work.m_viaNode[originIndex] = originIndex;
+   work.m_openSet.push_back(std::pair<int, unsigned int>(0, originIndex));
+}
+
+// take the lowest cost member of the open set, close it, and update the costs of the nodes connected to it.
+// A backward search follows the edges the wrong way, so it finds the costs *to* the origin.
+//
+// returns the index of the node closed, or -1 if the open set is empty or has nothing costing maxCost or less
+int GraphSnapshot::settleNext(SearchWorkspace &work, int maxCost, bool backward) const
+{
+   const std::vector<unsigned int> &edgeStart = backward ? m_reverseStart : m_edgeStart;
+   const std::vector<unsigned int> &edgeDest = backward ? m_reverseDest : m_edgeDest;
+   const std::vector<unsigned int> &edgeWeight = backward ? m_reverseWeight : m_edgeWeight;
+
+   while(!work.m_openSet.empty())
+   {
+      if(work.m_openSet.front().first > maxCost) return (-1);
+
+      std::pop_heap(work.m_openSet.begin(), work.m_openSet.end(), std::greater< std::pair<int, unsigned int> >());
+
+      int closedNodeCost = work.m_openSet.back().first;
+      unsigned int closedNode = work.m_openSet.back().second;
+
+      work.m_openSet.pop_back();
+
+      // a stale entry, the node was already closed at a lower cost
+      if(work.isSettled(closedNode)) continue;
+
+      work.m_settledStamp[closedNode] = work.m_stamp;
+
+      // see if this is a lower cost path to each of the connected nodes
+      for(unsigned int edge = edgeStart[closedNode]; edge < edgeStart[closedNode+1]; edge++)
+      {
+         unsigned int nextNode = edgeDest[edge];
+         int nextCost = closedNodeCost + edgeWeight[edge];
+
+         // too far to ever be closed in this search
+         if(nextCost > maxCost) continue;
+
+         if(work.isSettled(nextNode)) continue;
+
+         work.reachNode(nextNode, nextCost, closedNode);
+      }
+
+      return closedNode;
+   }
+
+   return (-1);
+}
+
+// the cheapest way from route[position] to the end of the route (destNode) that doesn't go back through
+// route[0..position], and doesn't start with a step to any of removedNext.  Returns its cost, with its
+// nodes in spurPath, or -1 if there's no such way for maxCost or less.
+//
+// It's an A* search, with the costs to destNode from the reverse shortest path tree in "tree" as the
+// estimates (they're exact, without the removed nodes and edges).  As soon as the tree's own way on from
+// the node being closed avoids the removed nodes and edges, that way is the answer, since nothing left
+// open could do better
+int GraphSnapshot::spurSearch(const std::vector<unsigned int> &route, unsigned int position, const std::vector<unsigned int> &removedNext,
+                              int maxCost, SearchWorkspace &tree, SearchWorkspace &work, std::vector<unsigned int> &spurPath) const
+{
+   unsigned int spurNode = route[position];
+   unsigned int destIndex = route.back();
+
+   spurPath.clear();
+
+   work.startSearch(m_nodeNumbers.size());
+
+   for(unsigned int i=0; i<=position; i++)
+   {
+      work.m_blockedStamp[route[i]] = work.m_stamp;
+   }
+
+   work.m_reachedStamp[spurNode] = work.m_stamp;
+   work.m_cost[spurNode] = 0;
+   work.m_viaNode[spurNode] = spurNode;
+   work.m_openSet.push_back(std::pair<int, unsigned int>(tree.m_cost[spurNode], spurNode));
+
+   while(!work.m_openSet.empty())
+   {
+      std::pop_heap(work.m_openSet.begin(), work.m_openSet.end(), std::greater< std::pair<int, unsigned int> >());
+
+      int estimate = work.m_openSet.back().first;
+      unsigned int closedNode = work.m_openSet.back().second;
+
+      work.m_openSet.pop_back();
+
+      // a stale entry, the node was already closed at a lower cost
+      if(work.isSettled(closedNode)) continue;
+
+      if(estimate > maxCost) return (-1);
+
+      work.m_settledStamp[closedNode] = work.m_stamp;
+
+      // see if the tree's way on from here is still open.  (Going through a node this search has closed
+      // would make a loop)
+      bool treeOpen = true;
+
+      for(unsigned int treeNode = closedNode; treeNode != destIndex; treeNode = tree.m_viaNode[treeNode])
+      {
+         unsigned int nextNode = tree.m_viaNode[treeNode];
+
+         if(work.isBlocked(nextNode) || work.isSettled(nextNode) ||
+            ((treeNode == spurNode) && (std::find(removedNext.begin(), removedNext.end(), nextNode) != removedNext.end())))
+         {
+            treeOpen = false;
+            break;
+         }
+      }
+
+      if(treeOpen)
+      {
+         for(unsigned int routeNode = closedNode; routeNode != spurNode; routeNode = work.m_viaNode[routeNode])
+         {
+            spurPath.push_back(routeNode);
+         }
+
+         spurPath.push_back(spurNode);
+         std::reverse(spurPath.begin(), spurPath.end());
+
+         for(unsigned int treeNode = closedNode; treeNode != destIndex; )
+         {
+            treeNode = tree.m_viaNode[treeNode];
+            spurPath.push_back(treeNode);
+         }
+
+         return work.m_cost[closedNode] + tree.m_cost[closedNode];
+      }
+
+      for(unsigned int edge = m_edgeStart[closedNode]; edge < m_edgeStart[closedNode+1]; edge++)
+      {
+         unsigned int nextNode = m_edgeDest[edge];
+
+         // nodes that can't get to destNode at all aren't in the tree
+         if(work.isBlocked(nextNode) || work.isSettled(nextNode) || !tree.isSettled(nextNode)) continue;
+
+         if((closedNode == spurNode) && (std::find(removedNext.begin(), removedNext.end(), nextNode) != removedNext.end())) continue;
+
+         int nextCost = work.m_cost[closedNode] + m_edgeWeight[edge];
+
+         if(nextCost + tree.m_cost[nextNode] > maxCost) continue;
+
+         if(!work.isReached(nextNode) || (nextCost < work.m_cost[nextNode]))
+         {
+            work.m_reachedStamp[nextNode] = work.m_stamp;
+            work.m_cost[nextNode] = nextCost;
+            work.m_viaNode[nextNode] = closedNode;
+
+            work.m_openSet.push_back(std::pair<int, unsigned int>(nextCost + tree.m_cost[nextNode], nextNode));
+            std::push_heap(work.m_openSet.begin(), work.m_openSet.end(), std::greater< std::pair<int, unsigned int> >());
+         }
+      }
+   }
+
+   return (-1);
+}
+
+// the same answers as Graph::doDijkstra(), but the search state lives in "work" rather than in the graph,
+// and the open set is a heap
+void GraphSnapshot::doDijkstra(unsigned int originNode, unsigned int destNode, SearchWorkspace &work,
+                               std::list<unsigned int> *pathList, int &pathCost) const
+{
+   // initialize the outcome
+   pathCost = 0;
+   pathList->clear();
+
+   // special case for origin == destination, just return
+   if(originNode == destNode)
+   {
+      return;
+   }
+
+   int originIndex = findNode(originNode);
+   int destIndex = findNode(destNode);
+
+   pathCost = -1;
+
+   if((originIndex == (-1)) || (destIndex == (-1))) return;
+
+   // don't bother searching if there's no route at all
+   if(!m_reach.canReach(originIndex, destIndex, work)) return;
+
+   beginSearch(originIndex, work);
+
+   int closedNode;
+
+   while((closedNode = settleNext(work, INT_MAX, false)) != (-1))
+   {
+      if(closedNode == destIndex)
+      {
+         pathCost = work.m_cost[destIndex];
+         break;
+      }
+   }
+
+   // walk the "from" nodes back to the origin to get the route
+   if(pathCost != (-1))
+   {
+      unsigned int routeNode = destIndex;
+
+      while(true)
+      {
+         pathList->push_front(m_nodeNumbers[routeNode]);
+
+         if(routeNode == static_cast<unsigned int>(originIndex)) break;
+
+         routeNode = work.m_viaNode[routeNode];
+      }
+   }
+}
+
+// the costs from one origin to several destinations, with a single search that stops as soon as the last
+// of them is closed.  pathCosts[i] is the cost to destNodes[i], or -1 if there's no path (and, as with the
+// single destination search, 0 if destNodes[i] is the origin, even if it doesn't exist)
+void GraphSnapshot::doDijkstra(unsigned int originNode, const std::vector<unsigned int> &destNodes, SearchWorkspace &work,
+                               std::vector<int> &pathCosts) const
+{
+   int originIndex = findNode(originNode);
+
+   pathCosts.assign(destNodes.size(), -1);
+
+   for(unsigned int i=0; i<destNodes.size(); i++)
+   {
+      if(destNodes[i] == originNode) pathCosts[i] = 0;
+   }
+
+   if(originIndex == (-1)) return;
+
+   // the dest indexes we're still waiting on, sorted so that we can look each closed node up quickly
+   std::vector<int> destIndexes;
+
+   for(unsigned int i=0; i<destNodes.size(); i++)
+   {
+      int destIndex = findNode(destNodes[i]);
+
+      if((destIndex != (-1)) && m_reach.canReach(originIndex, destIndex, work)) destIndexes.push_back(destIndex);
+   }
+
+   std::sort(destIndexes.begin(), destIndexes.end());
+   destIndexes.erase(std::unique(destIndexes.begin(), destIndexes.end()), destIndexes.end());
+
+   unsigned int numDestsLeft = destIndexes.size();
+
+   // none of them can be reached
+   if(numDestsLeft == 0) return;
+
+   beginSearch(originIndex, work);
+
+   int closedNode;
+
+   while(numDestsLeft && ((closedNode = settleNext(work, INT_MAX, false)) != (-1)))
+   {
+      if(std::binary_search(destIndexes.begin(), destIndexes.end(), closedNode)) numDestsLeft--;
+   }
+
+   for(unsigned int i=0; i<destNodes.size(); i++)
+   {
+      int destIndex = findNode(destNodes[i]);
+
+      if((destIndex != (-1)) && work.isSettled(destIndex)) pathCosts[i] = work.m_cost[destIndex];
+   }
+}
+
+// the cost from each of originNodes to each of destNodes, in row major order: pathCosts[i*destNodes.size() + j]
+// is the cost from originNodes[i] to destNodes[j], or -1 if there's no path.  As with doDijkstra(), a node
+// costs 0 to get to from itself, even if it doesn't exist.
+//
+// Without a node hierarchy to cut the searches short, meeting backward searches from the targets in the
+// middle would mean searching the whole graph from both sides.  So it's one search per row, which stops
+// as soon as the last target it can reach is closed, and skips the targets it can't reach.  If there are
+// fewer destinations than origins, it searches backward from each destination instead (a column at a
+// time).  The searches are shared out over numThreads threads (0 means all the cores), each with its own
+// workspace from works
+void GraphSnapshot::doDistanceTable(const std::vector<unsigned int> &originNodes, const std::vector<unsigned int> &destNodes,
+                                    std::vector<SearchWorkspace> &works, unsigned int numThreads, std::vector<int> &pathCosts) const
+{
+   pathCosts.assign(originNodes.size() * destNodes.size(), -1);
+
+   if(pathCosts.empty()) return;
+
+   if(numThreads == 0) numThreads = std::max(1U, std::thread::hardware_concurrency());
+
+   bool backward = (destNodes.size() < originNodes.size());
+   const std::vector<unsigned int> &searchFrom = backward ? destNodes : originNodes;
+   const std::vector<unsigned int> &searchTo = backward ? originNodes : destNodes;
+
+   numThreads = std::min<size_t>(numThreads, searchFrom.size());
+   works.resize(numThreads);
+
+   // the index of each node searched for, and a mark on each one so closed nodes can be checked quickly
+   std::vector<int> toIndexes(searchTo.size());
+   std::vector<unsigned int> targets;
+   std::vector<unsigned char> isTarget(m_nodeNumbers.size(), 0);
+
+   for(unsigned int j=0; j<searchTo.size(); j++)
+   {
+      toIndexes[j] = findNode(searchTo[j]);
+
+      if((toIndexes[j] != (-1)) && !isTarget[toIndexes[j]])
+      {
+         isTarget[toIndexes[j]] = 1;
+         targets.push_back(toIndexes[j]);
+      }
+   }
+
+   std::atomic<unsigned int> nextSearch(0);
+
+   runOnThreads(numThreads, [&](unsigned int t)
+   {
+      SearchWorkspace &work = works[t];
+      unsigned int i;
+
+      while((i = nextSearch++) < searchFrom.size())
+      {
+         int fromIndex = findNode(searchFrom[i]);
+
+         if(fromIndex == (-1)) continue;
+
+         unsigned int numTargetsLeft = 0;
+
+         for(unsigned int j=0; j<targets.size(); j++)
+         {
+            if(backward ? m_reach.canReach(targets[j], fromIndex, work) : m_reach.canReach(fromIndex, targets[j], work)) numTargetsLeft++;
+         }
+
+         // none of them can be reached
+         if(numTargetsLeft == 0) continue;
+
+         beginSearch(fromIndex, work);
+
+         int closedNode;
+
+         while(numTargetsLeft && ((closedNode = settleNext(work, INT_MAX, backward)) != (-1)))
+         {
+            if(isTarget[closedNode]) numTargetsLeft--;
+         }
+
+         for(unsigned int j=0; j<searchTo.size(); j++)
+         {
+            if((toIndexes[j] == (-1)) || !work.isSettled(toIndexes[j])) continue;
+
+            if(backward) pathCosts[j * destNodes.size() + i] = work.m_cost[toIndexes[j]];
+            else pathCosts[i * destNodes.size() + j] = work.m_cost[toIndexes[j]];
+         }
+      }
+   });
+
+   for(unsigned int i=0; i<originNodes.size(); i++)
+   {
+      for(unsigned int j=0; j<destNodes.size(); j++)
+      {
+         if(originNodes[i] == destNodes[j]) pathCosts[i * destNodes.size() + j] = 0;
+      }
+   }
+}
+
+// search the whole graph from the node at originIndex (or, backward, for routes to it).  closedNodes gets
+// the index of every node reached, cheapest first, and work.getCost() has the cost for each of them
+void GraphSnapshot::searchAll(unsigned int originIndex, bool backward, SearchWorkspace &work,
+                              std::vector<unsigned int> &closedNodes) const
+{
+   closedNodes.clear();
+
+   beginSearch(originIndex, work);
+
+   int closedNode;
+
+   while((closedNode = settleNext(work, INT_MAX, backward)) != (-1))
+   {
+      closedNodes.push_back(closedNode);
+   }
+}
+
+// up to k loopless routes from originNode to destNode, cheapest first (Yen's algorithm).  The first is the
+// shortest path, and each one after it is the cheapest route that isn't already in the list.
+//
+// Every candidate is a "spur" off an earlier route: it follows that route to some node, then takes the
+// cheapest way on that leaves it there and doesn't come back to it.  Two things keep that affordable.
+// One backward search from destNode gives the cost from every node to destNode.  That's an exact lower
+// bound for A* spur searches, and its tree usually finishes a spur search within a few nodes.  The spur
+// searches for each route are independent, so they're spread over numThreads threads (0 means all the
+// cores), each with its own workspace from works.  A route is only spurred from where it left the route
+// it came from (Lawler), since the earlier spurs were already tried from that route
+void GraphSnapshot::doKShortest(unsigned int originNode, unsigned int destNode, unsigned int k, std::vector<SearchWorkspace> &works,
+                                unsigned int numThreads, std::vector<alternativePath> &paths) const
+{
+   const unsigned int MIN_SPURS_PER_THREAD = 4;    // fewer than this isn't worth a thread
+
+   paths.clear();
+
+   if(k == 0) return;
+
+   // special case for origin == destination, the only route is to stay put
+   if(originNode == destNode)
+   {
+      paths.resize(1);
+      paths[0].m_pathCost = 0;
+      return;
+   }
+
+   int originIndex = findNode(originNode);
+   int destIndex = findNode(destNode);
+
+   if((originIndex == (-1)) || (destIndex == (-1))) return;
+
+   if(numThreads == 0) numThreads = std::max(1U, std::thread::hardware_concurrency());
+
+   works.resize(numThreads + 1);
+
+   SearchWorkspace &tree = works[0];
+
+   // don't bother searching if there's no route at all
+   if(!m_reach.canReach(originIndex, destIndex, tree)) return;
+
+   // the reverse shortest path tree: the cost from each node to destNode, and the next node on the way
+   beginSearch(destIndex, tree);
+
+   while(settleNext(tree, INT_MAX, true) != (-1));
+
+   std::vector< std::vector<unsigned int> > accepted;    // the routes so far, as node indexes
+   std::vector<unsigned int> deviation;                  // where each route left the one it was spurred from
+   std::vector<int> acceptedCost;
+
+   // the candidates, cheapest first, each with its deviation.  Being a map, the same route is never in twice
+   std::map< std::pair<int, std::vector<unsigned int> >, unsigned int > candidates;
+
+   accepted.resize(1);
+   deviation.push_back(0);
+   acceptedCost.push_back(tree.m_cost[originIndex]);
+
+   for(unsigned int routeNode = originIndex; ; routeNode = tree.m_viaNode[routeNode])
+   {
+      accepted[0].push_back(routeNode);
+
+      if(routeNode == static_cast<unsigned int>(destIndex)) break;
+   }
+
+   std::vector<int> rootCost;
+   std::vector< std::vector<unsigned int> > removedNext;
+   std::vector< std::vector<unsigned int> > spurPaths;
+   std::vector<int> spurCosts;
+
+   while(accepted.size() < k)
+   {
+      const std::vector<unsigned int> &route = accepted.back();
+
+      // the cost of the route up to each of its nodes
+      rootCost.assign(1, 0);
+
+      for(unsigned int i=0; i+1<route.size(); i++)
+      {
+         int edgeCost = 0;
+
+         for(unsigned int edge = m_edgeStart[route[i]]; edge < m_edgeStart[route[i]+1]; edge++)
+         {
+            if(m_edgeDest[edge] == route[i+1]) edgeCost = m_edgeWeight[edge];
+         }
+
+         rootCost.push_back(rootCost.back() + edgeCost);
+      }
+
+      // a spur from position i can't take the next step of any route found so far that starts the same way
+      removedNext.assign(route.size(), std::vector<unsigned int>());
+
+      for(unsigned int other=0; other<accepted.size(); other++)
+      {
+         const std::vector<unsigned int> &otherRoute = accepted[other];
+         unsigned int shared = 0;
+
+         while((shared < route.size()) && (shared < otherRoute.size()) && (route[shared] == otherRoute[shared])) shared++;
+
+         for(unsigned int i=0; (i < shared) && (i+1 < otherRoute.size()); i++)
+         {
+            removedNext[i].push_back(otherRoute[i+1]);
+         }
+      }
+
+      // only the cheapest (k - found) candidates can still make the list, so nothing dearer is worth finding
+      unsigned int numNeeded = k - accepted.size();
+      int maxCost = INT_MAX;
+
+      if(candidates.size() >= numNeeded)
+      {
+         std::map< std::pair<int, std::vector<unsigned int> >, unsigned int >::iterator lastNeeded = candidates.begin();
+
+         std::advance(lastNeeded, numNeeded - 1);
+         maxCost = lastNeeded->first.first;
+         candidates.erase(++lastNeeded, candidates.end());
+      }
+
+      unsigned int firstSpur = deviation.back();
+      unsigned int numSpurs = route.size() - 1 - firstSpur;
+      unsigned int spurThreads = std::max(1U, std::min(numThreads, numSpurs / MIN_SPURS_PER_THREAD));
+
+      spurPaths.resize(numSpurs);
+      spurCosts.assign(numSpurs, -1);
+
+      runOnThreads(spurThreads, [&](unsigned int t)
+      {
+         for(unsigned int spur=t; spur<numSpurs; spur+=spurThreads)
+         {
+            unsigned int position = firstSpur + spur;
+
+            spurCosts[spur] = spurSearch(route, position, removedNext[position], maxCost - rootCost[position],
+                                         tree, works[t+1], spurPaths[spur]);
+         }
+      });
+
+      for(unsigned int spur=0; spur<numSpurs; spur++)
+      {
+         if(spurCosts[spur] < 0) continue;
+
+         unsigned int position = firstSpur + spur;
+         std::pair<int, std::vector<unsigned int> > candidate;
+
+         candidate.first = rootCost[position] + spurCosts[spur];
+         candidate.second.assign(route.begin(), route.begin() + position);
+         candidate.second.insert(candidate.second.end(), spurPaths[spur].begin(), spurPaths[spur].end());
+
+         std::map< std::pair<int, std::vector<unsigned int> >, unsigned int >::iterator it = candidates.find(candidate);
+
+         if(it == candidates.end()) candidates[candidate] = position;
+         else it->second = std::min(it->second, position);
+      }
+
+      if(candidates.empty()) break;
+
+      accepted.push_back(candidates.begin()->first.second);
+      acceptedCost.push_back(candidates.begin()->first.first);
+      deviation.push_back(candidates.begin()->second);
+
+      candidates.erase(candidates.begin());
+   }
+
+   paths.resize(accepted.size());
+
+   for(unsigned int i=0; i<accepted.size(); i++)
+   {
+      paths[i].m_nodes.clear();
+
+      for(unsigned int j=0; j<accepted[i].size(); j++)
+      {
+         paths[i].m_nodes.push_back(m_nodeNumbers[accepted[i][j]]);
+      }
+
+      paths[i].m_pathCost = acceptedCost[i];
+   }
+}
+
+// the route from originNode to destNode with the fewest edges, ignoring the edge costs (pathCost is the
+// number of edges, or -1 if there's no route).
+//
+// A level-at-a-time breadth first search, split over numThreads threads (0 means all the cores), which
+// switches direction as it goes (Beamer et al.).  While the frontier is small, it works top down: each
+// frontier node claims its unreached neighbours.  Once the frontier's edges outnumber those left to check by
+// ALPHA to 1, it goes bottom up: each unreached node looks back along its incoming edges for a parent in the
+// frontier (a bitmap), and stops at the first one.  On low diameter graphs that skips most of the edges in
+// the big middle levels.  It goes back to top down when the frontier shrinks below 1/BETA of the nodes
+void GraphSnapshot::doBreadthFirst(unsigned int originNode, unsigned int destNode, BreadthFirstWorkspace &work,
+                                   unsigned int numThreads, std::list<unsigned int> *pathList, int &pathCost) const
+{
+   const unsigned int ALPHA = 14;
+   const unsigned int BETA = 24;
+   const unsigned int MIN_EDGES_PER_THREAD = 4096;   // less work than this in a level isn't worth a thread
+
+   // initialize the outcome
+   pathCost = 0;
+   pathList->clear();
+
+   // special case for origin == destination, just return
+   if(originNode == destNode)
+   {
+      return;
+   }
+
+   int originIndex = findNode(originNode);
+   int destIndex = findNode(destNode);
+
+   pathCost = -1;
+
+   if((originIndex == (-1)) || (destIndex == (-1))) return;
+
+   // don't bother searching if there's no route at all
+   if(!m_reach.canReach(originIndex, destIndex, work.m_reachWork)) return;
+
+   if(numThreads == 0) numThreads = std::max(1U, std::thread::hardware_concurrency());
+
+   unsigned int numNodes = m_nodeNumbers.size();
+   unsigned int stamp;
+
+   work.startSearch(numNodes, numThreads);
+   stamp = work.m_stamp;
+
+   work.m_reachedStamp[originIndex] = stamp;
+   work.m_parent[originIndex] = originIndex;
+   work.m_frontier.push_back(originIndex);
+
+   unsigned long long edgesToCheck = m_reverseDest.size() - getInDegree(originIndex);   // incoming edges of unreached nodes
+   bool bottomUp = false;
+   int numHops = 0;
+
+   while(!work.m_frontier.empty() && (work.m_reachedStamp[destIndex] != stamp))
+   {
+      unsigned long long frontierEdges = 0;
+
+      for(unsigned int i=0; i<work.m_frontier.size(); i++)
+      {
+         frontierEdges += getOutDegree(work.m_frontier[i]);
+      }
+
+      if(!bottomUp && (frontierEdges > edgesToCheck / ALPHA)) bottomUp = true;
+      else if(bottomUp && (work.m_frontier.size() < numNodes / BETA)) bottomUp = false;
+
+      unsigned long long levelWork = bottomUp ? edgesToCheck : frontierEdges;
+      unsigned int levelThreads = std::max(1ULL, std::min<unsigned long long>(numThreads, levelWork / MIN_EDGES_PER_THREAD));
+
+      for(unsigned int t=0; t<levelThreads; t++) work.m_nextFrontier[t].clear();
+
+      if(bottomUp)
+      {
+         unsigned int numWords = (numNodes + 63) / 64;
+
+         for(unsigned int word=0; word<numWords; word++) work.m_frontierBits[word].store(0, std::memory_order_relaxed);
+
+         for(unsigned int i=0; i<work.m_frontier.size(); i++)
+         {
+            unsigned int node = work.m_frontier[i];
+            work.m_frontierBits[node / 64].fetch_or(1ULL << (node % 64), std::memory_order_relaxed);
+         }
+
+         // each thread looks after its own range of nodes, so nobody else claims them
+         runOnThreads(levelThreads, [&](unsigned int t)
+         {
+            for(unsigned int node = static_cast<unsigned long long>(numNodes)*t/levelThreads;
+                node < static_cast<unsigned long long>(numNodes)*(t+1)/levelThreads; node++)
+            {
+               if(work.m_reachedStamp[node].load(std::memory_order_relaxed) == stamp) continue;
+
+               for(unsigned int edge = m_reverseStart[node]; edge < m_reverseStart[node+1]; edge++)
+               {
+                  unsigned int parent = m_reverseDest[edge];
+
+                  if(work.m_frontierBits[parent / 64].load(std::memory_order_relaxed) & (1ULL << (parent % 64)))
+                  {
+                     work.m_reachedStamp[node].store(stamp, std::memory_order_relaxed);
+                     work.m_parent[node] = parent;
+                     work.m_nextFrontier[t].push_back(node);
+                     break;
+                  }
+               }
+            }
+         });
+      }
+      else
+      {
+         // the threads share out the frontier, and race to claim each new node
+         runOnThreads(levelThreads, [&](unsigned int t)
+         {
+            for(unsigned int i = static_cast<unsigned long long>(work.m_frontier.size())*t/levelThreads;
+                i < static_cast<unsigned long long>(work.m_frontier.size())*(t+1)/levelThreads; i++)
+            {
+               unsigned int parent = work.m_frontier[i];
+
+               for(unsigned int edge = m_edgeStart[parent]; edge < m_edgeStart[parent+1]; edge++)
+               {
+                  unsigned int node = m_edgeDest[edge];
+                  unsigned int oldStamp = work.m_reachedStamp[node].load(std::memory_order_relaxed);
+
+                  if((oldStamp != stamp) && work.m_reachedStamp[node].compare_exchange_strong(oldStamp, stamp, std::memory_order_relaxed))
+                  {
+                     work.m_parent[node] = parent;
+                     work.m_nextFrontier[t].push_back(node);
+                  }
+               }
+            }
+         });
+      }
+
+      work.m_frontier.clear();
+
+      for(unsigned int t=0; t<levelThreads; t++)
+      {
+         work.m_frontier.insert(work.m_frontier.end(), work.m_nextFrontier[t].begin(), work.m_nextFrontier[t].end());
+      }
+
+      for(unsigned int i=0; i<work.m_frontier.size(); i++)
+      {
+         edgesToCheck -= getInDegree(work.m_frontier[i]);
+      }
+
+      numHops++;
+   }
+
+   // walk the parents back to the origin to get the route
+   if(work.m_reachedStamp[destIndex] == stamp)
+   {
+      unsigned int routeNode = destIndex;
+
+      while(true)
+      {
+         pathList->push_front(m_nodeNumbers[routeNode]);
+
+         if(routeNode == static_cast<unsigned int>(originIndex)) break;
+
+         routeNode = work.m_parent[routeNode];
+      }
+
+      pathCost = numHops;
+   }
+}
+
+// every node that can be reached from originNode for maxCost or less, in the order they're closed (cheapest
+// first).  The search stops as soon as everything left in the open set costs more than maxCost, and the
+// workspace needs no clearing, so a small radius search costs only as much as the part of the graph it covers
+void GraphSnapshot::doDijkstraWithin(unsigned int originNode, int maxCost, SearchWorkspace &work,
+                                     std::vector<settledNode> &settledNodes) const
+{
+   int originIndex = findNode(originNode);
+
+   settledNodes.clear();
+
+   if((originIndex == (-1)) || (maxCost < 0)) return;
+
+   beginSearch(originIndex, work);
+
+   int closedNode;
+
+   while((closedNode = settleNext(work, maxCost, false)) != (-1))
+   {
+      settledNode found;
+
+      found.m_nodeNumber = m_nodeNumbers[closedNode];
+      found.m_pathCost = work.m_cost[closedNode];
+
+      settledNodes.push_back(found);
+   }
+}
+
+
+//*****************************************************************
+//**
+//** VersionedGraph methods
+//**
+//*****************************************************************
+//
+
+VersionedGraph::VersionedGraph()
+{
+   m_version = 0;
+   m_epoch = 1;
+   m_numOverflowReaders = 0;
+
+   for(unsigned int slot=0; slot<MAX_READERS; slot++)
+   {
+      m_readerEpoch[slot] = 0;
+   }
+
+   // readers always have something to look at, even before the first publish()
+   m_current = new GraphSnapshot(m_graph, m_version);
+}
+
+// there must be no readers left by now
+VersionedGraph::~VersionedGraph()
+{
+   for(unsigned int i=0; i<m_retired.size(); i++)
+   {
+      delete m_retired[i].first;
+   }
+
+   delete m_current.load();
+}
+
+void VersionedGraph::queueChange(changeType type, unsigned int sourceNodeNumber, unsigned int destNodeNumber, unsigned int weight)
+{
+   graphChange change;
+
+   change.m_type = type;
+   change.m_sourceNodeNumber = sourceNodeNumber;
+   change.m_destNodeNumber = destNodeNumber;
+   change.m_weight = weight;
+
+   std::lock_guard<std::mutex> lock(m_pendingLock);
+   m_pendingChanges.push_back(change);
+}
+
+void VersionedGraph::addNode(unsigned int nodeNumber)
+{
+   queueChange(ADD_NODE, nodeNumber, 0, 0);
+}
+
+void VersionedGraph::addEdge(unsigned int sourceNodeNumber, unsigned int destNodeNumber, unsigned int edgeWeight)
+{
+   queueChange(ADD_EDGE, sourceNodeNumber, destNodeNumber, edgeWeight);
+}
+
+void VersionedGraph::setEdgeValue(unsigned int sourceNodeNumber, unsigned int destNodeNumber, unsigned int weight)
+{
+   queueChange(SET_EDGE_VALUE, sourceNodeNumber, destNodeNumber, weight);
+}
+
+unsigned int VersionedGraph::publish()
+{
+   return publishChanges(NULL);
+}
+
+// for loading a lot at once.  The builder is emptied
+unsigned int VersionedGraph::publish(GraphBuilder &builder)
+{
+   return publishChanges(&builder);
+}
+
+// apply the queued changes, then bulk (if there is one) after them, and swap in the new snapshot
+unsigned int VersionedGraph::publishChanges(GraphBuilder *bulk)
+{
+   std::lock_guard<std::mutex> publishLock(m_publishLock);
+   std::vector<graphChange> changes;
+
+   // take the whole batch, so writers can carry on queueing while we apply it
+   {
+      std::lock_guard<std::mutex> lock(m_pendingLock);
+      changes.swap(m_pendingChanges);
+   }
+
+   bool onlyWeights = (bulk == NULL);
+
+   for(unsigned int i=0; i<changes.size(); i++)
+   {
+      if(changes[i].m_type != SET_EDGE_VALUE) onlyWeights = false;
+   }
+
+   GraphSnapshot *newSnapshot;
+
+   if(onlyWeights)
+   {
+      // the nodes and edges are just as they were, so copy the weights from the current snapshot and patch
+      // them, rather than building the whole thing again
+      newSnapshot = new GraphSnapshot(*m_current.load(), ++m_version);
+
+      for(unsigned int i=0; i<changes.size(); i++)
+      {
+         m_graph.setEdgeValue(changes[i].m_sourceNodeNumber, changes[i].m_destNodeNumber, changes[i].m_weight);
+         newSnapshot->setEdgeValue(changes[i].m_sourceNodeNumber, changes[i].m_destNodeNumber, changes[i].m_weight);
+      }
+   }
+   else
+   {
+      // apply the changes in order.  Runs of new nodes and edges go through a builder in one go.  The builder
+      // adds all its nodes before its edges, so a node that comes after an edge from it has to wait for
+      // those edges to go in first (and be dropped, as Graph::addEdge() would)
+      GraphBuilder builder;
+      NodeNumberSet edgeSources;    // the sources of the edges waiting in the builder
+
+      for(unsigned int i=0; i<changes.size(); i++)
+      {
+         if(changes[i].m_type == ADD_NODE)
+         {
+            if(edgeSources.contains(changes[i].m_sourceNodeNumber))
+            {
+               builder.build(m_graph);
+               NodeNumberSet().swap(edgeSources);
+            }
+
+            builder.addNode(changes[i].m_sourceNodeNumber);
+         }
+         else if(changes[i].m_type == ADD_EDGE)
+         {
+            builder.addEdge(changes[i].m_sourceNodeNumber, changes[i].m_destNodeNumber, changes[i].m_weight);
+            edgeSources.insert(changes[i].m_sourceNodeNumber);
+         }
+         else
+         {
+            builder.build(m_graph);
+            NodeNumberSet().swap(edgeSources);
+            m_graph.setEdgeValue(changes[i].m_sourceNodeNumber, changes[i].m_destNodeNumber, changes[i].m_weight);
+         }
+      }
+
+      builder.build(m_graph);
+
+      if(bulk) bulk->build(m_graph);
+
+      newSnapshot = new GraphSnapshot(m_graph, ++m_version);
+   }
+
+   // swap in the new snapshot.  Any reader that starts after the epoch moves on is sure to see it,
+   // so the old one only has to wait for readers that started in an earlier epoch
+   GraphSnapshot *oldSnapshot = m_current.exchange(newSnapshot);
+   unsigned long retiredEpoch = m_epoch.fetch_add(1);
+
+   m_retired.push_back(std::pair<GraphSnapshot *, unsigned long>(oldSnapshot, retiredEpoch));
+
+   reclaimRetired();
+
+   return m_version;
+}
+
+// publish() does this every time, but it can also be called by itself to free memory sooner
+void VersionedGraph::reclaim()
+{
+   std::lock_guard<std::mutex> publishLock(m_publishLock);
+
+   reclaimRetired();
+}
+
+void VersionedGraph::reclaimRetired()
+{
+   // there's no telling which snapshot an overflow reader holds, so keep them all until they're gone
+   if(m_numOverflowReaders.load()) return;
+
+   unsigned long oldestReader = m_epoch.load();
+
+   for(unsigned int slot=0; slot<MAX_READERS; slot++)
+   {
+      unsigned long readerEpoch = m_readerEpoch[slot].load();
+
+      if(readerEpoch && (readerEpoch < oldestReader)) oldestReader = readerEpoch;
+   }
+
+   // anything retired before the oldest reader started can't be in use
+   unsigned int numKept = 0;
+
+   for(unsigned int i=0; i<m_retired.size(); i++)
+   {
+      if(m_retired[i].second < oldestReader)
+      {
+         delete m_retired[i].first;
+      }
+      else
+      {
+         m_retired[numKept++] = m_retired[i];
+      }
+   }
+
+   m_retired.resize(numKept);
+}
+
+
+//*****************************************************************
+//**
+//** GraphReadGuard methods
+//**
+//*****************************************************************
+//
+
+GraphReadGuard::GraphReadGuard(VersionedGraph &G) : m_graph(G)
+{
+   // spread the threads out over the slots so they don't all fight over the first one
+   unsigned int firstSlot = std::hash<std::thread::id>()(std::this_thread::get_id()) % VersionedGraph::MAX_READERS;
+
+   m_slot = firstSlot;
+
+   // claim a free slot by recording the epoch we started in
+   while(true)
+   {
+      unsigned long freeSlot = 0;
+
+      if(m_graph.m_readerEpoch[m_slot].compare_exchange_strong(freeSlot, m_graph.m_epoch.load())) break;
+
+      m_slot = (m_slot + 1) % VersionedGraph::MAX_READERS;
+
+      // all the slots are busy.  Rather than wait, be counted as an overflow reader, which stops any
+      // snapshot being reclaimed until we're done
+      if(m_slot == firstSlot)
+      {
+         m_graph.m_numOverflowReaders.fetch_add(1);
+         m_slot = VersionedGraph::MAX_READERS;
+         break;
+      }
+   }
+
+   m_snapshot = m_graph.m_current.load();
+}
+
+GraphReadGuard::~GraphReadGuard()
+{
+   if(m_slot == VersionedGraph::MAX_READERS) m_graph.m_numOverflowReaders.fetch_sub(1);
+   else m_graph.m_readerEpoch[m_slot].store(0);
+}
+
+const GraphSnapshot &GraphReadGuard::snapshot()
+{
+   return *m_snapshot;
+}
+
+
+//*****************************************************************
+//**
+//** GraphAnalytics methods
+//**
+//*****************************************************************
+//
+
+// numThreads of 0 means "use all the cores"
+GraphAnalytics::GraphAnalytics(const GraphSnapshot &S, unsigned int numThreads = 0) : m_graph(S)
+{
+   m_numThreads = numThreads ? numThreads : std::thread::hardware_concurrency();
+
+   if(m_numThreads == 0) m_numThreads = 1;
+
+   m_work.resize(m_numThreads);
+
+   for(unsigned int index=0; index<S.getNodeCount(); index++)
+   {
+      m_sourceOrder.push_back(index);
+   }
+
+   for(unsigned int i=1; i<m_sourceOrder.size(); i++)
+   {
+      std::swap(m_sourceOrder[i], m_sourceOrder[rand() % (i+1)]);
+   }
+
+   m_numSources = 0;
+   m_numRoutes = 0;
+   m_costBinWidth = 1;
+   m_diameterLow = -1;
+   m_diameterHigh = -1;
+   m_diameterComponentSize = 0;
+   m_diameterSearches = 0;
+}
+
+// search from more sources (in batches, one source per thread at a time) until the 95% confidence interval
+// of the average route cost is within relativeError of it, or maxSources have been searched altogether.
+// A smaller error or a bigger maxSources buys accuracy with time
+void GraphAnalytics::estimateAverageCost(double relativeError, unsigned int maxSources)
+{
+   const unsigned int MIN_SOURCES = 30;   // too few to trust the error estimate below this
+
+   maxSources = std::min<unsigned int>(maxSources, m_sourceOrder.size());
+
+   while(m_numSources < maxSources)
+   {
+      unsigned int batchSize = std::min(m_numThreads * 4, maxSources - m_numSources);
+      unsigned int firstSource = m_numSources;
+
+      m_sourceCostSums.resize(firstSource + batchSize);
+      m_sourceRouteCounts.resize(firstSource + batchSize);
+      m_sourceEccentricities.resize(firstSource + batchSize);
+
+      std::vector< std::vector<unsigned long long> > threadCostCounts(m_numThreads);
+      std::vector<unsigned int> threadBinWidths(m_numThreads, 1);
+
+      runOnThreads(m_numThreads, [&](unsigned int t)
+      {
+         std::vector<unsigned int> closedNodes;
+
+         for(unsigned int i = firstSource + t; i < firstSource + batchSize; i += m_numThreads)
+         {
+            unsigned int source = m_sourceOrder[i];
+
+            m_graph.searchAll(source, false, m_work[t], closedNodes);
+
+            double costSum = 0;
+            int eccentricity = 0;
+
+            // the first one closed is the source itself
+            for(unsigned int j=1; j<closedNodes.size(); j++)
+            {
+               int cost = m_work[t].getCost(closedNodes[j]);
+
+               costSum += cost;
+               eccentricity = std::max(eccentricity, cost);
+
+               countCost(threadCostCounts[t], threadBinWidths[t], cost, 1);
+            }
+
+            m_sourceCostSums[i] = costSum;
+            m_sourceRouteCounts[i] = closedNodes.size() - 1;
+            m_sourceEccentricities[i] = eccentricity;
+         }
+      });
+
+      for(unsigned int t=0; t<m_numThreads; t++)
+      {
+         widenCostBins(m_costCounts, m_costBinWidth, threadBinWidths[t]);
+
+         for(unsigned int bin=0; bin<threadCostCounts[t].size(); bin++)
+         {
+            if(threadCostCounts[t][bin]) countCost(m_costCounts, m_costBinWidth, bin * threadBinWidths[t], threadCostCounts[t][bin]);
+         }
+      }
+
+      for(unsigned int i=firstSource; i<firstSource + batchSize; i++)
+      {
+         m_numRoutes += m_sourceRouteCounts[i];
+      }
+
+      m_numSources += batchSize;
+
+      // with no routes found yet (a sparse graph), the error is meaningless, so keep looking
+      if((m_numSources >= MIN_SOURCES) && m_numRoutes && (getAverageCostError() <= relativeError * getAverageCost())) break;
+   }
+}
+
+// route costs are counted in at most MAX_COST_BINS bins of binWidth costs each.  When a cost doesn't fit,
+// the bins are merged in pairs and binWidth doubles, so the memory stays the same however big the costs get
+void GraphAnalytics::widenCostBins(std::vector<unsigned long long> &costCounts, unsigned int &binWidth, unsigned int newWidth)
+{
+   while(binWidth < newWidth)
+   {
+      for(unsigned int bin=0; bin<costCounts.size(); bin+=2)
+      {
+         costCounts[bin/2] = costCounts[bin] + ((bin+1 < costCounts.size()) ? costCounts[bin+1] : 0);
+      }
+
+      costCounts.resize((costCounts.size() + 1) / 2);
+      binWidth *= 2;
+   }
+}
+
+void GraphAnalytics::countCost(std::vector<unsigned long long> &costCounts, unsigned int &binWidth, unsigned int cost, unsigned long long count)
+{
+   while(cost / binWidth >= MAX_COST_BINS) widenCostBins(costCounts, binWidth, binWidth * 2);
+
+   unsigned int bin = cost / binWidth;
+
+   if(bin >= costCounts.size()) costCounts.resize(bin+1, 0);
+
+   costCounts[bin] += count;
+}
+
+// the average over every route found, from all the sources searched
+double GraphAnalytics::getAverageCost()
+{
+   double totalCost = 0;
+   double numRoutes = 0;
+
+   for(unsigned int i=0; i<m_numSources; i++)
+   {
+      totalCost += m_sourceCostSums[i];
+      numRoutes += m_sourceRouteCounts[i];
+   }
+
+   return numRoutes ? (totalCost / numRoutes) : 0;
+}
+
+// the average is a ratio of two sample means (cost per source / routes per source), so its standard error
+// comes from how far each source is from that ratio.  Sampling without replacement from a finite set of
+// sources, so the error shrinks to 0 once every source has been searched
+double GraphAnalytics::getAverageCostError()
+{
+   if(m_numSources < 2) return 0;
+
+   double average = getAverageCost();
+   double numRoutes = 0;
+   double sumSquares = 0;
+
+   for(unsigned int i=0; i<m_numSources; i++)
+   {
+      double residual = m_sourceCostSums[i] - average * m_sourceRouteCounts[i];
+
+      numRoutes += m_sourceRouteCounts[i];
+      sumSquares += residual * residual;
+   }
+
+   if(numRoutes == 0) return 0;
+
+   double routesPerSource = numRoutes / m_numSources;
+   double finitePopulation = 1.0 - static_cast<double>(m_numSources) / m_sourceOrder.size();
+   double variance = sumSquares / (m_numSources - 1) / m_numSources / (routesPerSource * routesPerSource) * finitePopulation;
+
+   return 1.96 * sqrt(variance);
+}
+
+// the longest route from (or, backward, to) the node at index, counting only the nodes in component
+int GraphAnalytics::findEccentricity(unsigned int index, bool backward, unsigned int component, SearchWorkspace &work)
+{
+   std::vector<unsigned int> closedNodes;
+   int eccentricity = 0;
+
+   m_graph.searchAll(index, backward, work, closedNodes);
+
+   for(unsigned int j=0; j<closedNodes.size(); j++)
+   {
+      if(m_graph.getReachability().getComponent(closedNodes[j]) == component)
+      {
+         eccentricity = std::max(eccentricity, work.getCost(closedNodes[j]));
+      }
+   }
+
+   return eccentricity;
+}
+
+// The diameter of the largest strongly connected component (the longest shortest route between two of its
+// nodes.  Routes between nodes in a component never leave it).
+//
+// Pick a well connected node u, and search from it both ways.  Any route x->y costs no more than
+// x->u->y, so once the eccentricities of the nodes farthest from u are known, the rest can be ruled out:
+// when every y not yet done is within F of u and every x not yet done is within B of it, no route between
+// them can beat F+B.  So take nodes farthest-first, and stop once the longest route found is F+B or more.
+// On real graphs that's usually after a handful of searches.  If maxSearches runs out first, the diameter
+// is only known to be in [low, high]
+void GraphAnalytics::computeDiameter(unsigned int maxSearches)
+{
+   const ReachabilityIndex &reach = m_graph.getReachability();
+
+   if(reach.getComponentCount() == 0) return;
+
+   // the largest component, and its best connected node
+   unsigned int component = 0;
+
+   for(unsigned int c=1; c<reach.getComponentCount(); c++)
+   {
+      if(reach.getComponentSize(c) > reach.getComponentSize(component)) component = c;
+   }
+
+   std::vector<unsigned int> members;
+   unsigned int center = 0;
+
+   for(unsigned int index=0; index<m_graph.getNodeCount(); index++)
+   {
+      if(reach.getComponent(index) != component) continue;
+
+      if(members.empty() || ((m_graph.getOutDegree(index) + m_graph.getInDegree(index)) >
+                             (m_graph.getOutDegree(center) + m_graph.getInDegree(center))))
+      {
+         center = index;
+      }
+
+      members.push_back(index);
+   }
+
+   m_diameterComponentSize = members.size();
+
+   // the costs from the center to every member, and from every member to the center
+   std::vector<int> fromCenter(m_graph.getNodeCount()), toCenter(m_graph.getNodeCount());
+   std::vector<unsigned int> closedNodes;
+
+   m_graph.searchAll(center, false, m_work[0], closedNodes);
+
+   for(unsigned int i=0; i<members.size(); i++) fromCenter[members[i]] = m_work[0].getCost(members[i]);
+
+   m_graph.searchAll(center, true, m_work[0], closedNodes);
+
+   for(unsigned int i=0; i<members.size(); i++) toCenter[members[i]] = m_work[0].getCost(members[i]);
+
+   m_diameterSearches = 2;
+
+   std::vector<unsigned int> farthestFrom(members), farthestTo(members);
+
+   std::sort(farthestFrom.begin(), farthestFrom.end(), [&](unsigned int a, unsigned int b) { return fromCenter[a] > fromCenter[b]; });
+   std::sort(farthestTo.begin(), farthestTo.end(), [&](unsigned int a, unsigned int b) { return toCenter[a] > toCenter[b]; });
+
+   int longest = std::max(fromCenter[farthestFrom[0]], toCenter[farthestTo[0]]);
+   unsigned int nextFrom = 0, nextTo = 0;
+
+   while(true)
+   {
+      // once every node on one side is done, every route has been accounted for
+      if((nextFrom == members.size()) || (nextTo == members.size()))
+      {
+         m_diameterHigh = longest;
+         break;
+      }
+
+      int bound = fromCenter[farthestFrom[nextFrom]] + toCenter[farthestTo[nextTo]];
+
+      m_diameterHigh = std::max(longest, bound);
+
+      if((longest >= bound) || (m_diameterSearches >= maxSearches)) break;
+
+      // the next few farthest nodes, one per thread.  A node far from the center needs its longest route
+      // *to* it (a backward search), a node far to the center needs its longest route *from* it
+      std::vector< std::pair<unsigned int, bool> > jobs;
+
+      while((jobs.size() < m_numThreads) && (nextFrom < members.size()) && (nextTo < members.size()))
+      {
+         if(fromCenter[farthestFrom[nextFrom]] >= toCenter[farthestTo[nextTo]])
+         {
+            jobs.push_back(std::pair<unsigned int, bool>(farthestFrom[nextFrom++], true));
+         }
+         else
+         {
+            jobs.push_back(std::pair<unsigned int, bool>(farthestTo[nextTo++], false));
+         }
+      }
+
+      std::vector<int> eccentricities(jobs.size());
+
+      runOnThreads(std::min<unsigned int>(m_numThreads, jobs.size()), [&](unsigned int t)
+      {
+         for(unsigned int i=t; i<jobs.size(); i+=m_numThreads)
+         {
+            eccentricities[i] = findEccentricity(jobs[i].first, jobs[i].second, component, m_work[t]);
+         }
+      });
+
+      for(unsigned int i=0; i<jobs.size(); i++)
+      {
+         longest = std::max(longest, eccentricities[i]);
+      }
+
+      m_diameterSearches += jobs.size();
+   }
+
+   m_diameterLow = longest;
+}
+
+int GraphAnalytics::getDiameterLow()
+{
+   return m_diameterLow;
+}
+
+int GraphAnalytics::getDiameterHigh()
+{
+   return m_diameterHigh;
+}
+
+void GraphAnalytics::printReport()
+{
+   unsigned long long numRoutes = m_numRoutes;
+
+   std::cout << "Average Path Cost is: ";
+
+   if(numRoutes)
+   {
+      std::cout << getAverageCost() << " (+/- " << getAverageCostError() << " at 95% confidence)" << std::endl;
+      std::cout << "Number of routes in the average : " << numRoutes << " from " << m_numSources
+                << " of " << m_sourceOrder.size() << " nodes" << std::endl;
+   }
+   else std::cout << "infinity" << std::endl;
+
+   // how the route costs are spread, in (at most) 20 bands, from the cheapest route seen (a source isn't
+   // counted as a route to itself, so the first few bins are usually empty)
+   if(numRoutes)
+   {
+      unsigned int usedBin = 0;
+
+      while((usedBin < m_costCounts.size()) && (m_costCounts[usedBin] == 0)) usedBin++;
+
+      unsigned int binsPerBand = (m_costCounts.size() - usedBin + 19) / 20;
+      unsigned long long bandWidth = static_cast<unsigned long long>(binsPerBand) * m_costBinWidth;
+
+      std::cout << "Path cost distribution:" << std::endl;
+
+      for(unsigned int firstBin=usedBin; firstBin<m_costCounts.size(); firstBin+=binsPerBand)
+      {
+         unsigned long long count = 0;
+         unsigned long long bandStart = static_cast<unsigned long long>(firstBin) * m_costBinWidth;
+
+         for(unsigned int bin=firstBin; (bin < firstBin + binsPerBand) && (bin < m_costCounts.size()); bin++)
+         {
+            count += m_costCounts[bin];
+         }
+
+         if(bandWidth == 1) std::cout << bandStart;
+         else std::cout << bandStart << "-" << (bandStart + bandWidth - 1);
+
+         std::cout << "\t" << (100.0 * count / numRoutes) << "%\t" << std::string(count * 50 / numRoutes, '#') << std::endl;
+      }
+   }
+
+   if(m_numSources)
+   {
+      int lowest = m_sourceEccentricities[0], highest = m_sourceEccentricities[0];
+      double total = 0;
+
+      for(unsigned int i=0; i<m_numSources; i++)
+      {
+         lowest = std::min(lowest, m_sourceEccentricities[i]);
+         highest = std::max(highest, m_sourceEccentricities[i]);
+         total += m_sourceEccentricities[i];
+      }
+
+      std::cout << "Eccentricity of the sampled nodes: lowest " << lowest << ", average " << total / m_numSources
+                << ", highest " << highest << std::endl;
+   }
+
+   if(m_diameterLow != (-1))
+   {
+      std::cout << "Diameter of the largest strongly connected component (" << m_diameterComponentSize << " nodes): ";
+
+      if(m_diameterLow == m_diameterHigh) std::cout << m_diameterLow;
+      else std::cout << "between " << m_diameterLow << " and " << m_diameterHigh;
+
+      std::cout << " (" << m_diameterSearches << " searches)" << std::endl;
+   }
+}
+
+
+//*****************************************************************
+//**
+//** Query server methods
+//**
+//*****************************************************************
+//
+
+// read or write all "length" bytes, unless the other end goes away (returns false if so)
+static bool readFully(int fd, void *buffer, size_t length)
+{
+   char *next = static_cast<char *>(buffer);
+
+   while(length)
+   {
+      ssize_t numRead = read(fd, next, length);
+
+      if(numRead < 0 && errno == EINTR) continue;
+      if(numRead <= 0) return false;
+
+      next += numRead;
+      length -= numRead;
+   }
+
+   return true;
+}
+
+static bool writeFully(int fd, const void *buffer, size_t length)
+{
+   const char *next = static_cast<const char *>(buffer);
+
+   while(length)
+   {
+      ssize_t numWritten = write(fd, next, length);
+
+      if(numWritten < 0 && errno == EINTR) continue;
+      if(numWritten <= 0) return false;
+
+      next += numWritten;
+      length -= numWritten;
+   }
+
+   return true;
+}
+
+// writeFully() for a client's answers, except that it never blocks for long: it waits for room to write
+// a little at a time, and gives up as soon as the connection is marked failed.  (The fd isn't made
+// non-blocking, since it can share its flags with the fd the requests are read from)
+static bool writeToClient(queryConnection &connection, const void *buffer, size_t length)
+{
+   const char *next = static_cast<const char *>(buffer);
+
+   while(length)
+   {
+      struct pollfd ready;
+
+      ready.fd = connection.m_writeFd;
+      ready.events = POLLOUT;
+      ready.revents = 0;
+
+      int numReady = poll(&ready, 1, 100);
+
+      if(numReady < 0 && errno != EINTR) return false;
+
+      {
+         std::lock_guard<std::mutex> lock(connection.m_lock);
+
+         if(connection.m_failed) return false;
+      }
+
+      if(numReady <= 0) continue;
+
+      // once poll() says there's room, a write of PIPE_BUF or less goes straight through
+      ssize_t numWritten = write(connection.m_writeFd, next, std::min(length, static_cast<size_t>(PIPE_BUF)));
+
+      if(numWritten < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+      if(numWritten <= 0) return false;
+
+      next += numWritten;
+      length -= numWritten;
+   }
+
+   return true;
+}
+
+queryConnection::queryConnection(int readFd, int writeFd) : m_readFd(readFd), m_writeFd(writeFd)
+{
+   m_numPending = 0;
+   m_readerDone = false;
+   m_failed = false;
+}
+
+queryConnection::~queryConnection()
+{
+   close(m_readFd);
+
+   if(m_writeFd != m_readFd) close(m_writeFd);
+}
+
+QueryQueue::QueryQueue()
+{
+   m_stub.m_next = NULL;
+   m_head = &m_stub;
+   m_tail = &m_stub;
+}
+
+void QueryQueue::push(queryItem *item)
+{
+   item->m_next.store(NULL, std::memory_order_relaxed);
+
+   // take our place at the head, then link the old head to us.  Until the link is made, pop() can't get past
+   // the old head, which is why pop() sometimes says the queue is empty when it isn't quite
+   queryItem *previous = m_head.exchange(item, std::memory_order_acq_rel);
+
+   previous->m_next.store(item, std::memory_order_release);
+}
+
+QueryQueue::queryItem *QueryQueue::pop()
+{
+   queryItem *tail = m_tail;
+   queryItem *next = tail->m_next.load(std::memory_order_acquire);
+
+   // step over the stub
+   if(tail == &m_stub)
+   {
+      if(next == NULL) return NULL;
+
+      m_tail = next;
+      tail = next;
+      next = next->m_next.load(std::memory_order_acquire);
+   }
+
+   if(next)
+   {
+      m_tail = next;
+      return tail;
+   }
+
+   // tail is the last item, and a push() is still linking in after it
+   if(tail != m_head.load(std::memory_order_acquire)) return NULL;
+
+   // tail really is the last item.  Put the stub back behind it so that it can be taken
+   push(&m_stub);
+
+   next = tail->m_next.load(std::memory_order_acquire);
+
+   if(next)
+   {
+      m_tail = next;
+      return tail;
+   }
+
+   return NULL;
+}
+
+// numThreads of 0 means "use all the cores"
+QueryServer::QueryServer(VersionedGraph &G, unsigned int maxBatch = 256, unsigned int numThreads = 0) : m_graph(G), m_maxBatch(maxBatch)
+{
+   m_numThreads = numThreads ? numThreads : std::max(1U, std::thread::hardware_concurrency());
+   m_works.resize(m_numThreads);
+
+   m_numQueued = 0;
+   m_engineSleeping = false;
+   m_stopping = false;
+   m_numClientThreads = 0;
+}
+
+// runs a socket client's reader or writer, and counts it out when it's done so that serveSocket() can wait
+// for it
+void QueryServer::runClientThread(void (QueryServer::*work)(std::shared_ptr<queryConnection>), std::shared_ptr<queryConnection> connection)
+{
+   (this->*work)(connection);
+
+   connection.reset();
+
+   std::lock_guard<std::mutex> lock(m_clientsLock);
+
+   m_numClientThreads--;
+   m_clientsDone.notify_all();
+}
+
+// reads requests from one client and queues them for the engine, until the client goes away
+void QueryServer::readRequests(std::shared_ptr<queryConnection> connection)
+{
+   std::vector<char> buffer(MAX_PENDING * sizeof(queryRequestFrame));
+   size_t numBuffered = 0;
+
+   while(true)
+   {
+      unsigned int room;
+
+      // don't read more than the client may have queued.  While it's at its limit the client's sends back
+      // up, which is what holds it back
+      {
+         std::unique_lock<std::mutex> lock(connection->m_lock);
+
+         connection->m_wake.wait(lock, [&connection]() { return (connection->m_numPending < MAX_PENDING) || connection->m_failed; });
+
+         if(connection->m_failed) break;
+
+         room = MAX_PENDING - connection->m_numPending;
+      }
+
+      // numBuffered is less than a frame, so there's always room for at least one more
+      ssize_t numRead = read(connection->m_readFd, &buffer[numBuffered], room * sizeof(queryRequestFrame) - numBuffered);
+
+      if(numRead < 0 && errno == EINTR) continue;
+      if(numRead <= 0) break;
+
+      numBuffered += numRead;
+
+      // queue every whole frame we have, and keep any part frame for next time
+      size_t numFrames = numBuffered / sizeof(queryRequestFrame);
+
+      {
+         std::lock_guard<std::mutex> lock(connection->m_lock);
+         connection->m_numPending += numFrames;
+      }
+
+      for(size_t i=0; i<numFrames; i++)
+      {
+         QueryQueue::queryItem *item = new QueryQueue::queryItem;
+
+         memcpy(&item->m_request, &buffer[i * sizeof(queryRequestFrame)], sizeof(queryRequestFrame));
+         item->m_connection = connection;
+
+         m_queue.push(item);
+      }
+
+      numBuffered -= numFrames * sizeof(queryRequestFrame);
+      memmove(&buffer[0], &buffer[numFrames * sizeof(queryRequestFrame)], numBuffered);
+
+      m_numQueued.fetch_add(numFrames);
+
+      // only bother with the lock if the engine might be asleep
+      if(m_engineSleeping.load())
+      {
+         std::lock_guard<std::mutex> lock(m_wakeLock);
+         m_wake.notify_one();
+      }
+   }
+
+   // the writer can finish once everything already queued has been answered
+   std::lock_guard<std::mutex> lock(connection->m_lock);
+
+   connection->m_readerDone = true;
+   connection->m_wake.notify_all();
+}
+
+// writes the answers for one client as the engine hands them over, until the client has stopped sending and
+// has had all its answers (or goes away)
+void QueryServer::writeResponses(std::shared_ptr<queryConnection> connection)
+{
+   std::vector<queryResponseFrame> responses;
+
+   while(true)
+   {
+      {
+         std::unique_lock<std::mutex> lock(connection->m_lock);
+
+         connection->m_wake.wait(lock, [&connection]()
+         {
+            return !connection->m_backlog.empty() || connection->m_failed ||
+                   (connection->m_readerDone && (connection->m_numPending == 0));
+         });
+
+         if(connection->m_failed || connection->m_backlog.empty()) break;
+
+         responses.swap(connection->m_backlog);
+      }
+
+      if(!writeToClient(*connection, &responses[0], responses.size() * sizeof(queryResponseFrame)))
+      {
+         std::lock_guard<std::mutex> lock(connection->m_lock);
+
+         connection->m_failed = true;
+         connection->m_backlog.clear();
+         connection->m_wake.notify_all();   // stops the reader if it's waiting for room
+         break;
+      }
+
+      responses.clear();
+   }
+}
+
+void QueryServer::runEngine()
+{
+   std::vector<QueryQueue::queryItem *> batch;
+   std::vector<queryConnection *> connectionsToWrite;
+   std::vector<unsigned int> groupStart;   // the queries from one origin are batch[groupStart[g]] .. batch[groupStart[g+1]-1]
+   std::vector<int> batchCosts;            // the answer to each query in the batch
+
+   while(true)
+   {
+      // take what's waiting (up to a batch's worth)
+      batch.clear();
+
+      QueryQueue::queryItem *item;
+
+      while((batch.size() < m_maxBatch) && ((item = m_queue.pop()) != NULL))
+      {
+         batch.push_back(item);
+      }
+
+      m_numQueued.fetch_sub(batch.size());
+
+      // a client that's been cut off doesn't get its answers, so don't spend any searches on them
+      unsigned int numKept = 0;
+
+      for(unsigned int i=0; i<batch.size(); i++)
+      {
+         queryConnection *connection = batch[i]->m_connection.get();
+         bool failed;
+
+         {
+            std::lock_guard<std::mutex> lock(connection->m_lock);
+
+            failed = connection->m_failed;
+
+            if(failed)
+            {
+               connection->m_numPending--;
+               connection->m_wake.notify_all();
+            }
+         }
+
+         // (outside the lock, since this can be the last hold on the connection)
+         if(failed) delete batch[i];
+         else batch[numKept++] = batch[i];
+      }
+
+      bool droppedAll = (numKept == 0) && !batch.empty();
+
+      batch.resize(numKept);
+
+      if(droppedAll) continue;
+
+      if(batch.empty())
+      {
+         if(m_stopping.load()) break;
+
+         // nothing to do, so sleep until a reader queues something.  A reader counts its queries before it
+         // checks m_engineSleeping, and we set m_engineSleeping before checking the count, so either it sees
+         // us asleep and wakes us, or we see its queries and don't sleep
+         std::unique_lock<std::mutex> lock(m_wakeLock);
+
+         m_engineSleeping = true;
+         m_wake.wait(lock, [this]() { return (m_numQueued.load() != 0) || m_stopping.load(); });
+         m_engineSleeping = false;
+
+         continue;
+      }
+
+      // one search per origin in the batch
+      std::sort(batch.begin(), batch.end(),
+                [](const QueryQueue::queryItem *a, const QueryQueue::queryItem *b) { return a->m_request.m_originNode < b->m_request.m_originNode; });
+
+      groupStart.clear();
+
+      for(unsigned int i=0; i<batch.size(); i++)
+      {
+         if((i == 0) || (batch[i]->m_request.m_originNode != batch[i-1]->m_request.m_originNode)) groupStart.push_back(i);
+      }
+
+      groupStart.push_back(batch.size());
+
+      unsigned int numGroups = groupStart.size() - 1;
+
+      batchCosts.resize(batch.size());
+
+      // the searches are shared out over the threads, each taking the next origin as it finishes one
+      {
+         GraphReadGuard guard(m_graph);
+         const GraphSnapshot &snapshot = guard.snapshot();
+         std::atomic<unsigned int> nextGroup(0);
+
+         runOnThreads(std::min(m_numThreads, numGroups), [&](unsigned int t)
+         {
+            std::vector<unsigned int> destNodes;
+            std::vector<int> pathCosts;
+            unsigned int g;
+
+            while((g = nextGroup++) < numGroups)
+            {
+               destNodes.clear();
+
+               for(unsigned int i=groupStart[g]; i<groupStart[g+1]; i++)
+               {
+                  destNodes.push_back(batch[i]->m_request.m_destNode);
+               }
+
+               snapshot.doDijkstra(batch[groupStart[g]]->m_request.m_originNode, destNodes, m_works[t], pathCosts);
+
+               std::copy(pathCosts.begin(), pathCosts.end(), batchCosts.begin() + groupStart[g]);
+            }
+         });
+      }
+
+      for(unsigned int i=0; i<batch.size(); i++)
+      {
+         queryResponseFrame response;
+
+         response.m_requestId = batch[i]->m_request.m_requestId;
+         response.m_pathCost = batchCosts[i];
+
+         if(batch[i]->m_connection->m_answered.empty()) connectionsToWrite.push_back(batch[i]->m_connection.get());
+
+         batch[i]->m_connection->m_answered.push_back(response);
+      }
+
+      // hand each client's answers to its writer.  A client that's gone away just doesn't get its answers,
+      // and one that's too far behind is cut off.  Its writer gives up within a poll() timeout, and for a
+      // socket the shutdown stops its reader too (for a pipe it just fails)
+      for(unsigned int i=0; i<connectionsToWrite.size(); i++)
+      {
+         queryConnection *connection = connectionsToWrite[i];
+         std::lock_guard<std::mutex> lock(connection->m_lock);
+
+         connection->m_numPending -= connection->m_answered.size();
+
+         if(!connection->m_failed && (connection->m_backlog.size() + connection->m_answered.size() > MAX_BACKLOG))
+         {
+            connection->m_failed = true;
+            connection->m_backlog.clear();
+            shutdown(connection->m_writeFd, SHUT_RDWR);
+         }
+
+         if(!connection->m_failed)
+         {
+            connection->m_backlog.insert(connection->m_backlog.end(), connection->m_answered.begin(), connection->m_answered.end());
+         }
+
+         connection->m_answered.clear();
+         connection->m_wake.notify_all();
+      }
+
+      connectionsToWrite.clear();
+
+      // this drops the batch's hold on the connections, which closes any that the client has finished with
+      for(unsigned int i=0; i<batch.size(); i++)
+      {
+         delete batch[i];
+      }
+   }
+}
+
+int QueryServer::serveSocket(const char *socketPath)
+{
+   struct sockaddr_un address;
+
+   if(strlen(socketPath) >= sizeof(address.sun_path)) return (-1);
+
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   strcpy(address.sun_path, socketPath);
+
+   int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+   if(listenFd < 0) return (-1);
+
+   // clear out the socket from any previous run
+   unlink(socketPath);
+
+   if((bind(listenFd, (struct sockaddr *)&address, sizeof(address)) < 0) || (listen(listenFd, 64) < 0))
+   {
+      close(listenFd);
+      return (-1);
+   }
+
+   // a client that hangs up early shouldn't take the server down with it
+   signal(SIGPIPE, SIG_IGN);
+
+   std::thread engine(&QueryServer::runEngine, this);
+   std::vector<std::weak_ptr<queryConnection> > clients;
+
+   while(true)
+   {
+      int clientFd = accept(listenFd, NULL, NULL);
+
+      if(clientFd < 0)
+      {
+         if((errno == EINTR) || (errno == ECONNABORTED)) continue;
+
+         // out of fds or memory for now: wait for some clients to finish rather than spin
+         if((errno == EMFILE) || (errno == ENFILE) || (errno == ENOBUFS) || (errno == ENOMEM))
+         {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+         }
+
+         break;
+      }
+
+      std::shared_ptr<queryConnection> connection(new queryConnection(clientFd, clientFd));
+
+      // forget the clients that have finished
+      clients.erase(std::remove_if(clients.begin(), clients.end(),
+                                   [](const std::weak_ptr<queryConnection> &client) { return client.expired(); }),
+                    clients.end());
+      clients.push_back(connection);
+
+      {
+         std::lock_guard<std::mutex> lock(m_clientsLock);
+         m_numClientThreads += 2;
+      }
+
+      std::thread(&QueryServer::runClientThread, this, &QueryServer::readRequests, connection).detach();
+      std::thread(&QueryServer::runClientThread, this, &QueryServer::writeResponses, connection).detach();
+   }
+
+   // the listening socket is broken.  Cut off every client (the shutdown gets a reader out of read(), and a
+   // writer gives up within a poll() timeout), and wait for their threads, since they use the server
+   close(listenFd);
+
+   for(unsigned int i=0; i<clients.size(); i++)
+   {
+      std::shared_ptr<queryConnection> connection = clients[i].lock();
+
+      if(!connection) continue;
+
+      std::lock_guard<std::mutex> lock(connection->m_lock);
+
+      connection->m_failed = true;
+      connection->m_backlog.clear();
+      shutdown(connection->m_readFd, SHUT_RDWR);
+      connection->m_wake.notify_all();
+   }
+
+   {
+      std::unique_lock<std::mutex> lock(m_clientsLock);
+
+      m_clientsDone.wait(lock, [this]() { return m_numClientThreads == 0; });
+   }
+
+   // then let the engine drop whatever the clients left queued
+   m_stopping = true;
+
+   {
+      std::lock_guard<std::mutex> lock(m_wakeLock);
+      m_wake.notify_one();
+   }
+
+   engine.join();
+
+   return (-1);
+}
+
+void QueryServer::serveStream(int readFd, int writeFd)
+{
+   signal(SIGPIPE, SIG_IGN);
+
+   std::thread engine(&QueryServer::runEngine, this);
+
+   std::shared_ptr<queryConnection> connection(new queryConnection(readFd, writeFd));
+   std::thread writer(&QueryServer::writeResponses, this, connection);
+
+   readRequests(connection);
+
+   // let the engine answer whatever's left, then stop
+   m_stopping = true;
+
+   {
+      std::lock_guard<std::mutex> lock(m_wakeLock);
+      m_wake.notify_one();
+   }
+
+   engine.join();
+   writer.join();
+}
+
+
+//*****************************************************************
+//**
+//** QueryLoadGenerator methods
+//**
+//*****************************************************************
+//
+
+// sends numRequests random queries over nodes 1..numNodes, at requestsPerSecond (or as fast as possible if 0).
+// Latency is timed from when each request was due to be sent, so a server that falls behind can't hide it
+int QueryLoadGenerator::run(const char *socketPath, unsigned int numNodes, unsigned int numRequests, unsigned int requestsPerSecond)
+{
+   struct sockaddr_un address;
+
+   if((numNodes == 0) || (strlen(socketPath) >= sizeof(address.sun_path))) return (-1);
+
+   memset(&address, 0, sizeof(address));
+   address.sun_family = AF_UNIX;
+   strcpy(address.sun_path, socketPath);
+
+   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+   if((fd < 0) || (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0))
+   {
+      if(fd >= 0) close(fd);
+      return (-1);
+   }
+
+   std::vector<long long> sendTime(numRequests);    // nanoseconds since start, by request id
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   m_latencies.clear();
+   m_latencies.reserve(numRequests);
+
+   // the answers come back on their own thread, in whatever order the server sends them
+   std::thread receiver([&]()
+   {
+      queryResponseFrame response;
+
+      while((m_latencies.size() < numRequests) && readFully(fd, &response, sizeof(response)))
+      {
+         long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+         m_latencies.push_back(now - sendTime[response.m_requestId]);
+      }
+   });
+
+   std::vector<queryRequestFrame> requests;
+   unsigned int nextRequest = 0;
+
+   while(nextRequest < numRequests)
+   {
+      long long now = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+      // send everything that's due, in one write
+      requests.clear();
+
+      while((nextRequest < numRequests) && (requests.size() < 1024))
+      {
+         long long due = requestsPerSecond ? (nextRequest * 1000000000LL / requestsPerSecond) : now;
+
+         if(due > now) break;
+
+         queryRequestFrame request;
+
+         request.m_requestId = nextRequest;
+         request.m_originNode = rand() % numNodes + 1;
+         request.m_destNode = rand() % numNodes + 1;
+
+         sendTime[nextRequest] = due;
+         requests.push_back(request);
+         nextRequest++;
+      }
+
+      if(requests.size())
+      {
+         if(!writeFully(fd, &requests[0], requests.size() * sizeof(queryRequestFrame))) break;
+      }
+      else
+      {
+         std::this_thread::sleep_until(start + std::chrono::nanoseconds(nextRequest * 1000000000LL / requestsPerSecond));
+      }
+   }
+
+   // no more requests, so the server closes its end once everything's answered
+   shutdown(fd, SHUT_WR);
+
+   receiver.join();
+   close(fd);
+
+   printReport(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+   return 0;
 }
 
+// writes a number with a fixed number of decimal places (never in scientific notation), leaving the stream
+// formatted as it was
+static void writeFixed(std::ostream &out, double value, int decimals)
+{
+   std::ios_base::fmtflags flags = out.flags();
+   std::streamsize precision = out.precision();
 
-// void Graph::deleteEdge(unsigned int sourceNodeNumber,unsigned int destNodeNumber)
-// {
-//    std::map<int, graphPoint* >::iterator it = graphNodes.find(sourceNodeNumber);
+   out << std::fixed << std::setprecision(decimals) << value;
 
-//    if( it != graphNodes.end())
-//    {
-//       if(!(it->second->deleteEdge(destNodeNumber))) m_totalNumEdges--;
-//    }
-// }
+   out.flags(flags);
+   out.precision(precision);
+}
 
-   
-//  make the specified node the origin
-void Graph::makeOriginNode(unsigned int nodeNumber)
+void QueryLoadGenerator::printReport(double elapsedSeconds)
 {
-   std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+   std::cout << "===== " << m_latencies.size() << " answers in ";
+   writeFixed(std::cout, elapsedSeconds, 3);
+   std::cout << " seconds (";
+   writeFixed(std::cout, m_latencies.size() / elapsedSeconds, 1);
+   std::cout << " per second)" << std::endl;
 
-   // To be complete, we should check if m_originNode is -1 before we set the origin.
-   // If m_originNode != -1, then the user had already set the origin, and is modifying it.
-   // In that case, we should remove "orgin-ness" from the originally set origin point
-   // For now, assume that the origin will not be changed once it's set.
+   if(m_latencies.empty()) return;
 
-   if( it != graphNodes.end())
+   std::sort(m_latencies.begin(), m_latencies.end());
+
+   const double percentiles[] = { 50, 90, 99, 99.9 };
+
+   for(unsigned int i=0; i<sizeof(percentiles)/sizeof(percentiles[0]); i++)
    {
-      it->second->modifyPoint (0, true);
-      m_originNode = nodeNumber;
+      size_t rank = static_cast<size_t>(percentiles[i] / 100 * (m_latencies.size() - 1));
+
+      std::cout << "p" << percentiles[i] << " latency: ";
+      writeFixed(std::cout, m_latencies[rank] / 1000.0, 1);
+      std::cout << " us" << std::endl;
    }
-}
 
-void Graph::setNodeValue(unsigned int nodeNumber, unsigned int cost)
-{
-   std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+   std::cout << "max latency: ";
+   writeFixed(std::cout, m_latencies.back() / 1000.0, 1);
+   std::cout << " us" << std::endl;
 
-   if( it != graphNodes.end())
+   // and a histogram, with a bucket for each power of 2 microseconds
+   std::vector<size_t> buckets;
+
+   for(size_t i=0; i<m_latencies.size(); i++)
    {
-      it->second->setPointCost (cost);
+      unsigned int bucket = 0;
+
+      for(long long micros = m_latencies[i] / 1000; micros > 1; micros >>= 1) bucket++;
+
+      if(bucket >= buckets.size()) buckets.resize(bucket+1, 0);
+
+      buckets[bucket]++;
+   }
+
+   std::cout << "latency histogram:" << std::endl;
+
+   for(unsigned int bucket=0; bucket<buckets.size(); bucket++)
+   {
+      std::cout << "< " << (2ULL << bucket) << " us\t" << buckets[bucket] << "\t"
+                << std::string(buckets[bucket] * 60 / m_latencies.size(), '#') << std::endl;
    }
 }
 
-// unsigned int Graph::getNodeValue(unsigned int nodeNumber)
-// {
-//    unsigned int retval = -1;
-//    std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
 
-//    if( it != graphNodes.end())
-//    {
-//       retval = it->second->getPointCost ();
-//    }
+//*****************************************************************
+//**
+//** ShardedGraph methods
+//**
+//*****************************************************************
+//
 
-//    return retval;
-// }
+// one message, header and records, each way between a ShardedGraph and a shard
+template<typename Record>
+static bool writeMessage(int fd, unsigned int type, int value, const std::vector<Record> &records)
+{
+   shardMessage message;
 
-// int Graph::setEdgeValue(unsigned int sourceNodeNumber,unsigned int destNodeNumber, unsigned int weight )
-// {
-//    unsigned int retval = -1;
-//    std::map<int, graphPoint* >::iterator it = graphNodes.find(sourceNodeNumber);
+   message.m_type = type;
+   message.m_count = records.size();
+   message.m_value = value;
 
-//    if( it != graphNodes.end())
-//    {
-//       retval = it->second->modifyEdge (destNodeNumber, weight);
-//    }
+   return (writeFully(fd, &message, sizeof(message)) &&
+           (records.empty() || writeFully(fd, &records[0], records.size() * sizeof(Record))));
+}
 
-//    return retval;
-// }
+template<typename Record>
+static bool readMessage(int fd, shardMessage &message, std::vector<Record> &records)
+{
+   if(!readFully(fd, &message, sizeof(message))) return false;
 
+   records.resize(message.m_count);
 
-//returns -1 if not found
-int Graph::getEdgeValue(unsigned int sourceNodeNumber,unsigned int destNodeNumber)
+   return (records.empty() || readFully(fd, &records[0], records.size() * sizeof(Record)));
+}
+
+// splits G into numShards shards and starts a process for each one.
+//
+// The partitioning is a simple edge cut: the shards get contiguous runs of node numbers, with about the
+// same number of nodes plus edges in each.  Real graphs tend to number nearby nodes together, so this cuts
+// far fewer edges than scattering the nodes would
+ShardedGraph::ShardedGraph(Graph &G, unsigned int numShards)
 {
-   unsigned int retval = -1;
-   std::map<int, graphPoint* >::iterator it = graphNodes.find(sourceNodeNumber);
+   const GraphSnapshot &S = G.getSnapshot();
+   unsigned int numNodes = S.getNodeCount();
 
-   if( it != graphNodes.end())
+   m_nodeNumbers = S.m_nodeNumbers;
+   m_numEdges = S.getEdgeCount();
+   m_numCutEdges = 0;
+   m_numSupersteps = 0;
+   m_bytesExchanged = 0;
+
+   numShards = std::max(1U, std::min(numShards, numNodes));
+
+   // cut wherever the running total of nodes plus edges passes the next share
+   unsigned long long totalWork = numNodes + m_numEdges;
+   unsigned long long workSoFar = 0;
+
+   m_shardStart.push_back(0);
+
+   for(unsigned int index=0; index<numNodes; index++)
    {
-      retval = it->second->getEdgeValue (destNodeNumber);
+      if((m_shardStart.size() < numShards) && (workSoFar >= totalWork * m_shardStart.size() / numShards))
+      {
+         if(index > m_shardStart.back()) m_shardStart.push_back(index);
+      }
+
+      workSoFar += 1 + S.getOutDegree(index);
    }
 
-   return retval;
-}
+   m_shardStart.push_back(numNodes);
 
-// bool Graph::isNodeVisited(unsigned int nodeNumber)
-// {
+   // a dead shard shows up as a failed read or write, rather than a signal
+   signal(SIGPIPE, SIG_IGN);
 
-//    bool retval = false;
-//    std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+   for(unsigned int shard=0; shard+1<m_shardStart.size(); shard++)
+   {
+      graphShard piece;
 
-//    if( it != graphNodes.end())
-//    {
-//       retval = it->second->getVisited();
-//    }
+      piece.m_firstNode = m_shardStart[shard];
 
-//    return retval;
+      for(unsigned int index=m_shardStart[shard]; index<m_shardStart[shard+1]; index++)
+      {
+         piece.m_edgeStart.push_back(piece.m_edgeDest.size());
 
-// }
+         for(unsigned int edge = S.m_edgeStart[index]; edge < S.m_edgeStart[index+1]; edge++)
+         {
+            piece.m_edgeDest.push_back(S.m_edgeDest[edge]);
+            piece.m_edgeWeight.push_back(S.m_edgeWeight[edge]);
 
-// void Graph::setNodeVisited(unsigned int nodeNumber)
-// {
-//    std::map<int, graphPoint* >::iterator it = graphNodes.find(nodeNumber);
+            if(findShard(S.m_edgeDest[edge]) != shard) m_numCutEdges++;
+         }
+      }
 
-//    if( it != graphNodes.end())
-//    {
-//       it->second->setVisited();
-//    }
+      piece.m_edgeStart.push_back(piece.m_edgeDest.size());
 
-// }
+      int fds[2];
 
+      if(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+      {
+         stopShards();
+         return;
+      }
 
-unsigned int Graph::getNodeCount()
-{
-   return m_totalNumVerticies;
+      pid_t pid = fork();
+
+      if(pid == 0)
+      {
+         // the shard only needs its own socket
+         close(fds[0]);
+
+         for(unsigned int i=0; i<m_shardFds.size(); i++) close(m_shardFds[i]);
+
+         runShard(fds[1], piece);
+         _exit(0);
+      }
+
+      close(fds[1]);
+
+      if(pid < 0)
+      {
+         close(fds[0]);
+         stopShards();
+         return;
+      }
+
+      m_shardFds.push_back(fds[0]);
+      m_shardPids.push_back(pid);
+   }
 }
 
-unsigned int Graph::getEdgeCount()
+ShardedGraph::~ShardedGraph()
 {
-   return m_totalNumEdges;
+   stopShards();
 }
 
-void Graph::printGraph()
+// tell the shards to quit, and wait for them to go
+void ShardedGraph::stopShards()
 {
-   unsigned int retval = -1;
-   
+   for(unsigned int shard=0; shard<m_shardFds.size(); shard++)
+   {
+      writeMessage(m_shardFds[shard], SHARD_QUIT, 0, std::vector<unsigned int>());
+      close(m_shardFds[shard]);
+   }
 
-   for(std::map<int, graphPoint* >::iterator it = graphNodes.begin(); it != graphNodes.end(); ++it)
+   for(unsigned int shard=0; shard<m_shardPids.size(); shard++)
    {
-      it->second->printGraphPoint();
+      waitpid(m_shardPids[shard], NULL, 0);
    }
 
-   std::cout << "TOTAL NODES: " << getNodeCount() << "\tTOTAL EDGES: " << getEdgeCount() << "\n" << std::endl;
- 
+   m_shardFds.clear();
+   m_shardPids.clear();
+}
 
+bool ShardedGraph::isRunning() const
+{
+   return !m_shardFds.empty();
 }
 
+unsigned int ShardedGraph::getShardCount() const
+{
+   return m_shardStart.size() - 1;
+}
 
+unsigned long long ShardedGraph::getEdgeCount() const
+{
+   return m_numEdges;
+}
 
-void Graph::doDijkstra( unsigned int originNode, unsigned int destNode, std::list<unsigned int> *pathList, int &pathCost)
+unsigned long long ShardedGraph::getCutEdgeCount() const
 {
-   bool validRouteFoundToDestination = false;
-   unsigned int closedNodeNum = originNode;
+   return m_numCutEdges;
+}
 
-   // std::cout << "---Running shortest path algorithm from node "<<originNode << " to node " << destNode << std::endl;
+unsigned long long ShardedGraph::getSuperstepCount() const
+{
+   return m_numSupersteps;
+}
+
+unsigned long long ShardedGraph::getBytesExchanged() const
+{
+   return m_bytesExchanged;
+}
+
+// the global index of this node number, -1 if not found
+int ShardedGraph::findIndex(unsigned int nodeNumber) const
+{
+   return findNodeIndex(m_nodeNumbers, nodeNumber);
+}
+
+// which shard has the node with this global index
+unsigned int ShardedGraph::findShard(unsigned int index) const
+{
+   return (std::upper_bound(m_shardStart.begin(), m_shardStart.end(), index) - m_shardStart.begin()) - 1;
+}
+
+template<typename Record>
+bool ShardedGraph::sendToShard(unsigned int shard, unsigned int type, int value, const std::vector<Record> &records)
+{
+   m_bytesExchanged += sizeof(shardMessage) + records.size() * sizeof(Record);
+
+   return writeMessage(m_shardFds[shard], type, value, records);
+}
+
+template<typename Record>
+bool ShardedGraph::receiveFromShard(unsigned int shard, shardMessage &message, std::vector<Record> &records)
+{
+   if(!readMessage(m_shardFds[shard], message, records)) return false;
+
+   m_bytesExchanged += sizeof(shardMessage) + records.size() * sizeof(Record);
+
+   return true;
+}
 
+// the same answer as Graph::doDijkstra, worked out by the shards together.
+//
+// Each superstep, every shard with updates to apply runs Dijkstra over its own nodes from them, and sends
+// back the costs it found for other shards' nodes.  Those become the next step's updates, minus any that
+// cost more than the best route to destNode found so far.  It's done when there are no updates left.  The
+// route is then traced back a shard at a time, through the via nodes the shards kept
+void ShardedGraph::doDijkstra(unsigned int originNode, unsigned int destNode, std::list<unsigned int> *pathResult, int &pathCost)
+{
    // initialize the outcome
    pathCost = 0;
-   pathList->clear();
+   pathResult->clear();
 
    // special case for origin == destination, just return
    if(originNode == destNode)
@@ -480,214 +5134,276 @@ void Graph::doDijkstra( unsigned int originNode, unsigned int destNode, std::lis
       return;
    }
 
-   // before starting, clean the nodes of computed values in case we're re-running the algorythm
-   for(std::map<int, graphPoint* >::iterator itGraphNode = graphNodes.begin(); itGraphNode != graphNodes.end(); ++itGraphNode)
+   pathCost = -1;
+
+   int originIndex = findIndex(originNode);
+   int destIndex = findIndex(destNode);
+
+   if((originIndex == (-1)) || (destIndex == (-1)) || !isRunning()) return;
+
+   unsigned int numShards = m_shardFds.size();
+
+   std::vector< std::vector<shardUpdate> > inbox(numShards);
+   std::vector< std::vector<shardUpdate> > outbox(numShards);
+   std::vector<shardUpdate> replies;
+   shardMessage message;
+   int bestCost = INT_MAX;
+
+   for(unsigned int shard=0; shard<numShards; shard++)
    {
-      itGraphNode->second->cleanNode();
+      if(!sendToShard(shard, SHARD_NEW_SEARCH, destIndex, std::vector<shardUpdate>()))
+      {
+         stopShards();
+         return;
+      }
    }
 
-   //
-   // run the shortest path algorithm on the graph passed in
-   //
-   makeOriginNode(originNode);
+   shardUpdate start;
 
-   std::vector<unsigned int> openSet;    // a set of all "not yet visited" Nodes
+   start.m_node = originIndex;
+   start.m_viaNode = originIndex;
+   start.m_pathCost = 0;
 
+   inbox[findShard(originIndex)].push_back(start);
 
    while(true)
    {
-      int numNodesAddedToOpenSet = 0;
-         
-      // std::cout << "New closed node: " << closedNodeNum << std::endl;
-      //
-      // add the connected nodes from this node to the open set (Step N+1)
-      //
-      std::map<int, graphPoint* >::iterator itGraphNode = graphNodes.find(closedNodeNum);
+      bool anyUpdates = false;
 
-      unsigned int closedNodeCost = itGraphNode->second->m_totalCost;
+      for(unsigned int shard=0; shard<numShards; shard++)
+      {
+         if(inbox[shard].empty()) continue;
 
-      // std::cout << "The closed node cost is "<< closedNodeCost << std::endl;
+         anyUpdates = true;
 
-      // get all the nodes connected to this one and 
-      // adjust the costs and (from node) values of each connected node
-      // itGraphEdge->first is the connected node number and itGraphEdge->second is the edge cost
-      for(std::map<unsigned int, unsigned int>::iterator itGraphEdge= itGraphNode->second->m_edges.begin(); 
-          itGraphEdge != itGraphNode->second->m_edges.end(); 
-          ++itGraphEdge)
-      {
+         if(!sendToShard(shard, SHARD_STEP, bestCost, inbox[shard]))
+         {
+            stopShards();
+            return;
+         }
+      }
 
-         // first, mark this node as visited
-         itGraphNode->second->setVisited();
+      if(!anyUpdates) break;
 
-         //         std::cout << "Examining node " << itGraphEdge->first << std::endl;
+      m_numSupersteps++;
 
-         std::map<int, graphPoint* >::iterator itNextEdgeNode = graphNodes.find(itGraphEdge->first);
+      // collect all the answers first, so bestCost is as low as it gets before filtering them
+      for(unsigned int shard=0; shard<numShards; shard++)
+      {
+         if(inbox[shard].empty()) continue;
 
-         if(itNextEdgeNode == graphNodes.end()) continue;  // no node actually exists 
+         inbox[shard].clear();
 
-         int i;
-         for(i=0; i<openSet.size(); i++)
+         if(!receiveFromShard(shard, message, replies))
          {
-            if(openSet[i] == itNextEdgeNode->second->m_nodeNumber) break;
+            stopShards();
+            return;
          }
 
-          // add it to the open set if it's not there already and it hasn't already been visited
-         if(i == openSet.size() && (itNextEdgeNode->second->getVisited() == false))
+         if((message.m_value >= 0) && (message.m_value < bestCost)) bestCost = message.m_value;
+
+         for(unsigned int i=0; i<replies.size(); i++)
          {
-            openSet.push_back(itNextEdgeNode->second->m_nodeNumber);
-            numNodesAddedToOpenSet++;
-          }
+            outbox[findShard(replies[i].m_node)].push_back(replies[i]);
+         }
+      }
 
-          // now see if this is a lower cost path to this connected node
-          if(itNextEdgeNode->second->getPointCost() == (-1) || 
-             (closedNodeCost + itGraphEdge->second) <  itNextEdgeNode->second->getPointCost())
-          {
+      for(unsigned int shard=0; shard<numShards; shard++)
+      {
+         for(unsigned int i=0; i<outbox[shard].size(); i++)
+         {
+            if(outbox[shard][i].m_pathCost < bestCost) inbox[shard].push_back(outbox[shard][i]);
+         }
 
-              // new lower cost found
-             itNextEdgeNode->second->setPointCost(static_cast<int>(closedNodeCost + itGraphEdge->second));
-             itNextEdgeNode->second->m_viaNode = closedNodeNum;
+         outbox[shard].clear();
+      }
+   }
 
+   if(bestCost == INT_MAX) return;
 
-             // std::cout << "found new lower cost (" << itNextEdgeNode->second->getPointCost() 
-             //           << ") to node " << itGraphEdge->first << " from node " 
-             //           << closedNodeNum << std::endl;
+   // follow the via nodes back from the destination.  Each shard walks the route until it leaves the shard
+   std::vector<unsigned int> route;
+   int nextIndex = destIndex;
 
-          } 
-       }
+   while(nextIndex >= 0)
+   {
+      unsigned int shard = findShard(nextIndex);
 
-       // std::cout << "Openset now has " << openSet.size() << " members " << std::endl;
+      if(!sendToShard(shard, SHARD_TRACE, nextIndex, std::vector<unsigned int>()) ||
+         !receiveFromShard(shard, message, route))
+      {
+         stopShards();
+         pathResult->clear();
+         return;
+      }
+
+      for(unsigned int i=0; i<route.size(); i++)
+      {
+         pathResult->push_front(m_nodeNumbers[route[i]]);
+      }
 
-       //if we didn't add any new members to the openset and it's empty, we are done
-       if ( (openSet.size() == 0) &&  (numNodesAddedToOpenSet == 0) )
-       {
-          //          std::cout << "openset is empty" << std::endl;
-          break;
-       }
+      nextIndex = message.m_value;
+   }
 
-       // Now, find the lowest cost member of the open set and make it the new closed set member
+   pathCost = bestCost;
+}
 
-       unsigned int lowest_cost_node;
-       unsigned int lowest_cost_index;
+// a shard process: answers messages from the ShardedGraph on fd until told to quit (or it goes away)
+void ShardedGraph::runShard(int fd, const graphShard &shard)
+{
+   unsigned int numNodes = shard.m_edgeStart.size() - 1;
+   SearchWorkspace work;                                  // by local index, but with global via nodes
+   int destNode = -1;                                     // local index, or -1 if it's not in this shard
 
-       for (int i=0; i<openSet.size(); i++)
-       {
-          int lowest_cost_val;
+   shardMessage message;
+   std::vector<shardUpdate> updates;
+   std::vector<shardUpdate> sends;
+   std::vector<unsigned int> noRecords;
 
-          std::map<int, graphPoint* >::iterator itGraphNode = graphNodes.find(openSet[i]);
+   while(readMessage(fd, message, updates))
+   {
+      if(message.m_type == SHARD_QUIT) return;
 
-          // std::cout << "i: " << i << " openset[i]: " << openSet[i] <<" nodenum: " <<  
-          //    itGraphNode->second->m_nodeNumber << " cost: " << itGraphNode->second->m_totalCost
-          //           << std::endl;
+      if(message.m_type == SHARD_NEW_SEARCH)
+      {
+         work.startSearch(numNodes);
 
-          if((i==0) || (itGraphNode->second->m_totalCost < lowest_cost_val ))
-          {
+         destNode = message.m_value - (int)shard.m_firstNode;
 
-             lowest_cost_node = itGraphNode->second->m_nodeNumber;
-             lowest_cost_val = itGraphNode->second->m_totalCost;
-             lowest_cost_index = i;
-             // std::cout << "found new lowest cost node : " << lowest_cost_node << std::endl;
-          }
-       }
+         if((destNode < 0) || (destNode >= (int)numNodes)) destNode = -1;
+      }
+      else if(message.m_type == SHARD_STEP)
+      {
+         int bestCost = message.m_value;
 
+         if((destNode >= 0) && work.isReached(destNode)) bestCost = std::min(bestCost, work.m_cost[destNode]);
 
-       // this is the node that we'll be evaluating in the next iteration
-       closedNodeNum = lowest_cost_node;
+         for(unsigned int i=0; i<updates.size(); i++)
+         {
+            work.reachNode(updates[i].m_node - shard.m_firstNode, updates[i].m_pathCost, updates[i].m_viaNode);
+         }
 
-       // remove that node from the open set
-       // std::cout << "deleting node: " << lowest_cost_node << std::endl;
+         sends.clear();
 
-       for(std::vector<unsigned int>::iterator vit = openSet.begin(); vit != openSet.end(); ++vit)
-       {
+         // nodes are never marked settled here: one can be reached more cheaply through another shard in a
+         // later step, and then has to be opened again
+         while(!work.m_openSet.empty())
+         {
+            std::pop_heap(work.m_openSet.begin(), work.m_openSet.end(), std::greater< std::pair<int, unsigned int> >());
 
-          // std::cout << "lowest_cost_node is: " << lowest_cost_node << " and found openSet member number " << *vit << std::endl;
+            int closedNodeCost = work.m_openSet.back().first;
+            unsigned int closedNode = work.m_openSet.back().second;
 
-          if (*vit == lowest_cost_node)
-          {
-             // std::cout << "erasing member!" << std::endl;
-             openSet.erase(vit);
-             break;
-          }
-       }
+            work.m_openSet.pop_back();
 
-       // std::cout << "Post delete: Openset now has " << openSet.size() << " members " << std::endl;
+            // a stale entry, the node has been reached more cheaply since
+            if(closedNodeCost != work.m_cost[closedNode]) continue;
 
+            // going through the destination can't get back to it any cheaper
+            if(closedNodeCost >= bestCost) continue;
 
-       //if that node is the dest node, we have succeeded and we are done
-       if (closedNodeNum == destNode)
-       {
-          validRouteFoundToDestination = true;
-          // std::cout << "***Found a route to the destination node!" << std::endl;
+            if((int)closedNode == destNode)
+            {
+               bestCost = closedNodeCost;
+               continue;
+            }
 
+            for(unsigned int edge = shard.m_edgeStart[closedNode]; edge < shard.m_edgeStart[closedNode+1]; edge++)
+            {
+               int nextCost = closedNodeCost + shard.m_edgeWeight[edge];
 
-          break;
-       }
+               if(nextCost >= bestCost) continue;
 
-       //else keep on truckin'
-    }
+               unsigned int nextNode = shard.m_edgeDest[edge] - shard.m_firstNode;
 
-   //
-   // Now tell the user whether or not we've been able to find a route
-   //   If so, print out the route
-   //   else, well..there's not much we can do except break the bad news
-   //
-    if(validRouteFoundToDestination == true)
-    {
-       std::vector<unsigned int> routeSet;
+               // another shard's node, so that shard will hear about it in the next step
+               if(nextNode >= numNodes)
+               {
+                  shardUpdate update;
 
-       // now print out the route
+                  update.m_node = shard.m_edgeDest[edge];
+                  update.m_viaNode = closedNode + shard.m_firstNode;
+                  update.m_pathCost = nextCost;
 
-       unsigned int routeNode = destNode;
-       unsigned int lastRouteNode = routeNode;
+                  sends.push_back(update);
+                  continue;
+               }
 
-       // reuse the openSet vector to record the final route
-       pathCost = 0;
+               work.reachNode(nextNode, nextCost, closedNode + shard.m_firstNode);
+            }
+         }
 
-       while(true)
-       {
-          pathList->push_front(routeNode);
+         // only the cheapest update for each node is worth sending
+         std::sort(sends.begin(), sends.end(), [](const shardUpdate &a, const shardUpdate &b)
+         {
+            return (a.m_node < b.m_node) || ((a.m_node == b.m_node) && (a.m_pathCost < b.m_pathCost));
+         });
 
-          // if we've added the orig to the route record, then we're done
-          if(routeNode == originNode) break;
+         sends.erase(std::unique(sends.begin(), sends.end(), [](const shardUpdate &a, const shardUpdate &b)
+         {
+            return a.m_node == b.m_node;
+         }), sends.end());
 
-          //         std::cout << "route reclaimation looking for node " << routeNode << std::endl;
-          //         std::cout << "route reclaimation found node " << 
-          //            graphNodes.find(routeNode)->second->m_nodeNumber << std::endl;
+         int destCost = (destNode >= 0) ? work.getCost(destNode) : (-1);
 
-          // remember the "from" node for the cost computation
-          lastRouteNode = routeNode;
+         if(!writeMessage(fd, SHARD_STEP, destCost, sends)) return;
+      }
+      else if(message.m_type == SHARD_TRACE)
+      {
+         // the route back from the node, as far as it stays in this shard.  The value sent back is where
+         // to carry on from, or -1 at the origin (which is its own via node)
+         std::vector<unsigned int> route;
+         unsigned int node = message.m_value;
+         int nextNode = -1;
 
-          // find the "next" node
-          routeNode = graphNodes.find(routeNode)->second->m_viaNode;
+         while(true)
+         {
+            route.push_back(node);
 
-          //         std::cout << "route reclaimation found viaNode..." << routeNode << std::endl;
+            unsigned int via = work.m_viaNode[node - shard.m_firstNode];
 
-          // record this hop in the total cost of the path
+            if(via == node) break;
 
-          // std::cout << "Cost of route from " << routeNode << " to " << lastRouteNode << 
-          //    " is " << getEdgeValue(routeNode, lastRouteNode) << std::endl;
+            if((via < shard.m_firstNode) || (via - shard.m_firstNode >= numNodes))
+            {
+               nextNode = via;
+               break;
+            }
 
-          pathCost += getEdgeValue(routeNode, lastRouteNode);
+            node = via;
+         }
 
-          
-       }
-    }
-    else
-    {
-       // std::cout << "Count not find a route from " << originNode << " to " << destNode << std::endl;
-       pathList->clear();  // no elements in the list
-       pathCost = -1;
-    }
+         if(!writeMessage(fd, SHARD_TRACE, nextNode, route)) return;
+      }
+   }
+}
 
- }
 
-ShortestPathAlgo::ShortestPathAlgo() : pathCost(-1)
+ShortestPathAlgo::ShortestPathAlgo() : pathCost(-1), mode(WEIGHTED)
 {
    pathList = new std::list<unsigned int>;
+   work = new SearchWorkspace;
+   withinList = new std::vector<settledNode>;
+   bfsWork = new BreadthFirstWorkspace;
+   pathsWork = new std::vector<SearchWorkspace>;
+   alternativeList = new std::vector<alternativePath>;
+   costTable = new std::vector<int>;
 } 
 
 ShortestPathAlgo::~ShortestPathAlgo()
 {
    delete pathList;
+   delete work;
+   delete withinList;
+   delete bfsWork;
+   delete pathsWork;
+   delete alternativeList;
+   delete costTable;
+}
+
+void ShortestPathAlgo::setMode(queryMode newMode)
+{
+   mode = newMode;
 } 
  
 // returns a count of the nodes
@@ -699,17 +5415,87 @@ unsigned int ShortestPathAlgo::verticies(Graph &G)
 // returns the cost of the path (or -1 if no path exists)
 int ShortestPathAlgo::path_size( Graph &G, unsigned int originNode, unsigned int destNode )
 {
+   if(mode == HOP_COUNT) return path_size(G.getSnapshot(), originNode, destNode);
+
    G.doDijkstra(originNode, destNode, pathList, pathCost);
    return pathCost;
 }
 
 // returns a list with the path
 std::list<unsigned int> *ShortestPathAlgo::path( Graph &G, unsigned int originNode, unsigned int destNode)
+{
+   if(mode == HOP_COUNT) return path(G.getSnapshot(), originNode, destNode);
+
+   G.doDijkstra(originNode, destNode, pathList, pathCost);
+   return pathList;
+}
+
+// returns the cost of the path (or -1 if no path exists)
+int ShortestPathAlgo::path_size( const GraphSnapshot &S, unsigned int originNode, unsigned int destNode )
+{
+   if(mode == HOP_COUNT) S.doBreadthFirst(originNode, destNode, *bfsWork, 0, pathList, pathCost);
+   else S.doDijkstra(originNode, destNode, *work, pathList, pathCost);
+
+   return pathCost;
+}
+
+// returns a list with the path
+std::list<unsigned int> *ShortestPathAlgo::path( const GraphSnapshot &S, unsigned int originNode, unsigned int destNode)
+{
+   if(mode == HOP_COUNT) S.doBreadthFirst(originNode, destNode, *bfsWork, 0, pathList, pathCost);
+   else S.doDijkstra(originNode, destNode, *work, pathList, pathCost);
+
+   return pathList;
+}
+
+// returns the best k routes
+std::vector<alternativePath> *ShortestPathAlgo::alternatives( Graph &G, unsigned int originNode, unsigned int destNode, unsigned int k)
+{
+   return alternatives(G.getSnapshot(), originNode, destNode, k);
+}
+
+std::vector<alternativePath> *ShortestPathAlgo::alternatives( const GraphSnapshot &S, unsigned int originNode, unsigned int destNode, unsigned int k)
+{
+   S.doKShortest(originNode, destNode, k, *pathsWork, 0, *alternativeList);
+   return alternativeList;
+}
+
+// returns the table of costs between two sets of nodes
+std::vector<int> *ShortestPathAlgo::distances( Graph &G, const std::vector<unsigned int> &originNodes, const std::vector<unsigned int> &destNodes)
+{
+   return distances(G.getSnapshot(), originNodes, destNodes);
+}
+
+std::vector<int> *ShortestPathAlgo::distances( const GraphSnapshot &S, const std::vector<unsigned int> &originNodes, const std::vector<unsigned int> &destNodes)
+{
+   S.doDistanceTable(originNodes, destNodes, *pathsWork, 0, *costTable);
+   return costTable;
+}
+
+int ShortestPathAlgo::path_size( ShardedGraph &G, unsigned int originNode, unsigned int destNode )
+{
+   G.doDijkstra(originNode, destNode, pathList, pathCost);
+   return pathCost;
+}
+
+std::list<unsigned int> *ShortestPathAlgo::path( ShardedGraph &G, unsigned int originNode, unsigned int destNode)
 {
    G.doDijkstra(originNode, destNode, pathList, pathCost);
    return pathList;
 }
 
+// returns the nodes within maxCost of the origin, and their costs
+std::vector<settledNode> *ShortestPathAlgo::within( Graph &G, unsigned int originNode, int maxCost)
+{
+   return within(G.getSnapshot(), originNode, maxCost);
+}
+
+std::vector<settledNode> *ShortestPathAlgo::within( const GraphSnapshot &S, unsigned int originNode, int maxCost)
+{
+   S.doDijkstraWithin(originNode, maxCost, *work, *withinList);
+   return withinList;
+}
+
 std::ostream &operator<< (std::ostream &cout, std::list<unsigned int> *path)
 {
    unsigned routeLen = path->size();
@@ -734,10 +5520,182 @@ std::ostream &operator<< (std::ostream &cout, std::list<unsigned int> *path)
    return cout;
 }
 
+// collect a random graph with nodes 1..graphSize, and an edge from each node to each other node with a
+// probability of prob percent, with a random distance from 1-10.  The builder drops any edge to a node
+// that already has an edge to this node, so there are never edges both ways
+static void makeRandomGraph(GraphBuilder &builder, int graphSize, int prob)
+{
+   for (int nodeNum=1; nodeNum<=graphSize; nodeNum++)
+   {
+      builder.addNode(nodeNum);
+   }
+
+   for (int fromNodeNum=1; fromNodeNum<=graphSize; fromNodeNum++)
+   {
+      for (int toNodeNum = 1; toNodeNum <= graphSize; toNodeNum++)
+      {
+         // no edges to self
+         if(fromNodeNum == toNodeNum) continue;
+
+         if((rand() % 100) < prob)
+         {
+            builder.addEdge(fromNodeNum, toNodeNum, rand()%10+1);
+         }
+      }
+   }
+}
+
+// graph --server <socket path, or - for stdin/stdout> <number of nodes> <edge percent>
+static int serverMain(int argc, char *argv[])
+{
+   if(argc != 5)
+   {
+      std::cerr << "usage: " << argv[0] << " --server <socket path, or - for stdin/stdout> <number of nodes> <edge percent>" << std::endl;
+      return(1);
+   }
+
+   srand (time(NULL));
+
+   VersionedGraph G;
+   GraphBuilder builder;
+
+   makeRandomGraph(builder, atoi(argv[3]), atoi(argv[4]));
+   G.publish(builder);
+
+   QueryServer server(G);
+
+   // stdout carries the answers in stream mode, so all the chatter goes to stderr
+   if(std::string(argv[2]) == "-")
+   {
+      std::cerr << "Serving queries on stdin/stdout" << std::endl;
+      server.serveStream(0, 1);
+      return(0);
+   }
+
+   std::cerr << "Serving queries on " << argv[2] << std::endl;
+
+   if(server.serveSocket(argv[2]) < 0)
+   {
+      std::cerr << "Could not serve queries on " << argv[2] << std::endl;
+   }
+
+   return(1);
+}
+
+// graph --loadgen <socket path> <number of nodes> <number of requests> [requests per second]
+static int loadGeneratorMain(int argc, char *argv[])
+{
+   if((argc != 5) && (argc != 6))
+   {
+      std::cerr << "usage: " << argv[0] << " --loadgen <socket path> <number of nodes> <number of requests> [requests per second]" << std::endl;
+      return(1);
+   }
+
+   srand (time(NULL));
+
+   QueryLoadGenerator loadGenerator;
+
+   if(loadGenerator.run(argv[2], atoi(argv[3]), atoi(argv[4]), (argc == 6) ? atoi(argv[5]) : 0) < 0)
+   {
+      std::cerr << "Could not connect to " << argv[2] << std::endl;
+      return(1);
+   }
+
+   return(0);
+}
+
+// graph --shard-bench <number of nodes> <edge percent> [most shards] [number of queries]
+//
+// times the same random queries on one process, then on 1, 2, 4 ... shards
+static int shardBenchMain(int argc, char *argv[])
+{
+   if((argc < 4) || (argc > 6))
+   {
+      std::cerr << "usage: " << argv[0] << " --shard-bench <number of nodes> <edge percent> [most shards] [number of queries]" << std::endl;
+      return(1);
+   }
+
+   int graphSize = atoi(argv[2]);
+   int prob = atoi(argv[3]);
+   unsigned int maxShards = (argc > 4) ? atoi(argv[4]) : 8;
+   unsigned int numQueries = (argc > 5) ? atoi(argv[5]) : 200;
+
+   srand (time(NULL));
+
+   Graph G;
+   GraphBuilder builder;
+
+   makeRandomGraph(builder, graphSize, prob);
+   builder.build(G);
+
+   std::vector< std::pair<unsigned int, unsigned int> > queries;
+   std::vector<int> answers;
+
+   for(unsigned int i=0; i<numQueries; i++)
+   {
+      queries.push_back(std::pair<unsigned int, unsigned int>(rand()%graphSize+1, rand()%graphSize+1));
+   }
+
+   std::cout << "Graph has " << G.getNodeCount() << " nodes and " << G.getEdgeCount() << " edges, "
+             << numQueries << " queries" << std::endl;
+
+   ShortestPathAlgo dijkstra;
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   for(unsigned int i=0; i<numQueries; i++)
+   {
+      answers.push_back(dijkstra.path_size(G.getSnapshot(), queries[i].first, queries[i].second));
+   }
+
+   double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+   std::cout << "  1 process:  " << elapsed * 1000.0 / numQueries << " ms/query" << std::endl;
+
+   for(unsigned int numShards=1; numShards<=maxShards; numShards*=2)
+   {
+      ShardedGraph sharded(G, numShards);
+
+      if(!sharded.isRunning())
+      {
+         std::cerr << "Could not start " << numShards << " shards" << std::endl;
+         return(1);
+      }
+
+      unsigned int numWrong = 0;
+
+      start = std::chrono::steady_clock::now();
+
+      for(unsigned int i=0; i<numQueries; i++)
+      {
+         if(dijkstra.path_size(sharded, queries[i].first, queries[i].second) != answers[i]) numWrong++;
+      }
+
+      elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+      std::cout << "  " << sharded.getShardCount() << " shards: " << elapsed * 1000.0 / numQueries << " ms/query, "
+                << 100.0 * sharded.getCutEdgeCount() / std::max(1ULL, sharded.getEdgeCount()) << "% of edges cut, "
+                << (double)sharded.getSuperstepCount() / numQueries << " supersteps and "
+                << sharded.getBytesExchanged() / 1024.0 / numQueries << " KB exchanged per query";
+
+      if(numWrong) std::cout << ", " << numWrong << " WRONG ANSWERS";
+
+      std::cout << std::endl;
+
+      if(sharded.getShardCount() < numShards) break;
+   }
+
+   return(0);
+}
+
 //#define USING_KNOWN_GRAPH
 
- int main()
+ int main(int argc, char *argv[])
  {
+    // the query server modes
+    if((argc > 1) && (std::string(argv[1]) == "--server")) return serverMain(argc, argv);
+    if((argc > 1) && (std::string(argv[1]) == "--loadgen")) return loadGeneratorMain(argc, argv);
+    if((argc > 1) && (std::string(argv[1]) == "--shard-bench")) return shardBenchMain(argc, argv);
+
 
 #ifdef USING_KNOWN_GRAPH
 
@@ -819,31 +5777,11 @@ std::ostream &operator<< (std::ostream &cout, std::list<unsigned int> *path)
     }while (print_graph_entry != 'y' && print_graph_entry != 'n');
 
 
-    // my graph class won't let you add an edge to some node that doesn't exist
-    // so make all the nodes first
-    for (int nodeNum=1; nodeNum<=graphSize; nodeNum++)
-    {
-       G.addNode(nodeNum);
-    }
-
-    // now, make any desired edges according to the probability
-    for (int fromNodeNum=1; fromNodeNum<=graphSize; fromNodeNum++)
-    {
-       for (int toNodeNum = 1; toNodeNum <= graphSize; toNodeNum++)
-       {
-          // no edges to self
-          if(fromNodeNum == toNodeNum) continue;
-
-          // no edges to a node that has edges to this node (uni-directional)
-          if(G.hasEdge(toNodeNum, fromNodeNum)) continue;
+    // collect the whole graph in a builder and load it in one go, rather than an addEdge() at a time
+    GraphBuilder builder;
 
-          // add an edge based on probability
-          if((rand() % 100) < prob)
-          {
-             G.addEdge(fromNodeNum, toNodeNum, rand()%10+1);  // this is a random distance from 1-10
-          }
-       }
-    }
+    makeRandomGraph(builder, graphSize, prob);
+    builder.build(G);
 
     // print it out but only if the user wants to take a look at it
     if(print_graph_entry == 'y' )
@@ -868,35 +5806,15 @@ std::ostream &operator<< (std::ostream &cout, std::list<unsigned int> *path)
     if(path_size > 0)
        std::cout << "===== The shortest route cost is :" << path_size << std::endl;
 
-    float averagePathCost = 0;
-
+    // statistics over the whole graph: the average route cost (to within 1%, or from every node, whichever
+    // comes first), and the diameter (exact if it takes no more than 200 searches)
     std::cout << "===== Now computing the average route cost =====" << std::endl;
 
-    unsigned int num_elements_in_avg = 0;
-
-    // now compute the average path cost
-    for(int i=1; i<G.getNodeCount(); i++)
-    {
-       // std::cout << "cost from 1 to " << i << " is " << dijkstra.path_size(G, 1, i) << std::endl;
-
-       if(dijkstra.path_size(G, 1, i) <= 0) continue;
-      
-       averagePathCost += dijkstra.path_size(G, 1, i);
-
-       num_elements_in_avg += 1;
-
-    }
+    GraphAnalytics analytics(G.getSnapshot());
 
-    // print out the resultant average path cost
-    //
-    std::cout << "Average Path Cost is: ";
-
-    if(num_elements_in_avg)
-    {
-       std::cout <<  averagePathCost/num_elements_in_avg << std::endl;
-       std::cout << "Number of nodes in the average : " << num_elements_in_avg;
-    }
-    else std::cout << "infinity";
+    analytics.estimateAverageCost(0.01, G.getNodeCount());
+    analytics.computeDiameter(200);
+    analytics.printReport();
 
     std::cout << std::endl;
         